@@ -337,6 +337,14 @@ static void gtktsm_face_free(struct gtktsm_face *face)
 	free(face);
 }
 
+static void gtktsm_face_flush(struct gtktsm_face *face)
+{
+	if (!face)
+		return;
+
+	shl_htable_clear_ulong(&face->glyphs, free_glyph, NULL);
+}
+
 static unsigned int c2f(cairo_format_t format)
 {
 	switch (format) {
@@ -1052,9 +1060,17 @@ static void gtktsm_renderer_draw(const struct gtktsm_renderer_ctx *ctx)
 	 * but at least it's fast enough to render a whole screen. */
 
 	cairo_surface_flush(rend->surface);
-	rend->age = tsm_screen_draw(ctx->screen,
-				    renderer_draw_cell,
-				    (void*)ctx);
+	/* In debug mode all cells are visited so unchanged ones can be shown
+	 * without highlighting. Otherwise, let tsm skip unchanged cells. */
+	if (ctx->debug)
+		rend->age = tsm_screen_draw(ctx->screen,
+					    renderer_draw_cell,
+					    (void*)ctx);
+	else
+		rend->age = tsm_screen_draw_since(ctx->screen,
+						  rend->age,
+						  renderer_draw_cell,
+						  (void*)ctx);
 	cairo_surface_mark_dirty(rend->surface);
 
 	cairo_set_source_surface(ctx->cr, rend->surface, 0, 0);
@@ -1124,6 +1140,7 @@ typedef struct _GtkTsmTerminalPrivate {
 	guint idle_src;
 
 	/* cache */
+	unsigned long sym_epoch;
 	GdkKeymap *keymap;
 	unsigned int width;
 	unsigned int height;
@@ -1303,6 +1320,7 @@ static gboolean terminal_draw_fn(GtkWidget *widget,
 	GtkTsmTerminalPrivate *p = gtktsm_terminal_get_instance_private(term);
 	struct gtktsm_renderer_ctx ctx;
 	struct tsm_screen_attr attr;
+	unsigned long epoch;
 	int64_t start, end;
 
 	if (!p->face_regular) {
@@ -1317,6 +1335,17 @@ static gboolean terminal_draw_fn(GtkWidget *widget,
 
 	start = g_get_monotonic_time();
 
+	/* glyphs are cached by symbol id, which tsm reuses after collecting
+	 * unused combined symbols */
+	epoch = tsm_screen_get_symbol_epoch(p->screen);
+	if (epoch != p->sym_epoch) {
+		gtktsm_face_flush(p->face_regular);
+		gtktsm_face_flush(p->face_bold);
+		gtktsm_face_flush(p->face_italic);
+		gtktsm_face_flush(p->face_bold_italic);
+		p->sym_epoch = epoch;
+	}
+
 	memset(&ctx, 0, sizeof(ctx));
 	ctx.debug = p->show_dirty;
 	ctx.rend = p->rend;
@@ -1544,6 +1573,13 @@ static void terminal_write_fn(struct tsm_vte *vte,
 		p->idle_src = g_idle_add(terminal_idle_fn, term);
 }
 
+static void terminal_change_fn(struct tsm_screen *screen, void *data)
+{
+	GtkTsmTerminal *term = data;
+
+	gtk_widget_queue_draw(GTK_WIDGET(term));
+}
+
 static void terminal_log_fn(void *data,
 			    const char *file,
 			    int line,
@@ -1796,6 +1832,8 @@ static void gtktsm_terminal_init(GtkTsmTerminal *term)
 	if (r < 0)
 		g_error("tsm_screen_new() failed: %d", r);
 
+	tsm_screen_set_change_cb(p->screen, terminal_change_fn, term);
+
 	r = tsm_vte_new(&p->vte,
 			p->screen,
 			terminal_write_fn,
@@ -1949,8 +1987,8 @@ static void terminal_read_fn(struct shl_pty *pty,
 	GtkTsmTerminal *term = data;
 	GtkTsmTerminalPrivate *p = gtktsm_terminal_get_instance_private(term);
 
+	/* redraws are queued by terminal_change_fn() */
 	tsm_vte_input(p->vte, u8, len);
-	gtk_widget_queue_draw(GTK_WIDGET(term));
 }
 
 static void terminal_child_fn(GPid pid,
@@ -1999,6 +2037,11 @@ pid_t gtktsm_terminal_fork(GtkTsmTerminal *term)
 	else if (!pid)
 		return pid;
 
+	/* hand the vte everything read per dispatch in one go, up to 1MiB */
+	r = shl_pty_set_input_ring(p->pty, 1024 * 1024);
+	if (r < 0)
+		g_error("shl_pty_set_input_ring() failed: %d", r);
+
 	r = shl_pty_bridge_add(p->pty_bridge, p->pty);
 	if (r < 0)
 		g_error("shl_pty_bridge_add() failed: %d", r);
@@ -0,0 +1,432 @@
+/*
+ * SHL - Concurrent hash-table
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Concurrent hash-table
+ * The table is an open-addressing array of (hash, elem) slots with linear
+ * probing. Writers hold @lock and publish a slot by storing its hash before
+ * releasing the element pointer, so a reader that sees an element also sees
+ * its hash. A removed slot becomes CHT_DELETED and is never turned back into
+ * an empty slot, so probe sequences of concurrent readers are never cut
+ * short. Deleted slots may be reused by later inserts. Growing and purging
+ * deleted slots builds a new array and publishes it with a single pointer
+ * store; readers keep probing whichever array they loaded.
+ *
+ * Memory is reclaimed with two-phase reader counters like userspace RCU.
+ * Readers increment the counter of the current phase on entry and decrement
+ * it on exit. shl_chtable_synchronize() flips the phase and waits for the old
+ * counter to drain, twice, so every reader that entered before the call has
+ * left. The counters are striped over cache lines and each thread sticks to
+ * one stripe, so readers on different CPUs do not bounce a shared line.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl-chtable.h"
+#include "shl-macro.h"
+
+#define CHT_MIN_BITS 4
+#define CHT_STRIPES 64
+#define CHT_DELETED ((void*)1)
+
+struct cht_slot {
+	size_t hash;
+	void *elem;
+};
+
+struct cht_array {
+	struct cht_array *next;		/* retired list */
+	unsigned int bits;
+	size_t used;			/* elements plus deleted slots */
+	struct cht_slot slots[];
+};
+
+struct cht_stripe {
+	unsigned long count[2];
+} __attribute__((__aligned__(64)));
+
+struct shl_chtable {
+	bool (*compare) (const void *a, const void *b);
+
+	struct cht_array *array;	/* read without lock */
+	unsigned long phase;		/* read without lock */
+	struct cht_stripe stripes[CHT_STRIPES];
+
+	pthread_mutex_t lock;		/* serializes writers */
+	pthread_mutex_t sync_lock;	/* serializes phase flips */
+	size_t elems;
+	struct cht_array *retired;
+};
+
+static unsigned int cht_next_stripe;
+static __thread unsigned int cht_stripe;
+
+static size_t cht_index(size_t hash, unsigned int bits)
+{
+	/* spread identity hashes of small integers over the whole table */
+	return (size_t)(((uint64_t)hash * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+}
+
+static struct cht_array *cht_array_new(unsigned int bits)
+{
+	struct cht_array *a;
+
+	a = calloc(1, sizeof(*a) + (sizeof(struct cht_slot) << bits));
+	if (!a)
+		return NULL;
+
+	a->bits = bits;
+	return a;
+}
+
+int shl_chtable_new(struct shl_chtable **out,
+		    bool (*compare) (const void *a, const void *b))
+{
+	struct shl_chtable *t;
+	int r;
+
+	if (!out || !compare)
+		return -EINVAL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	t->compare = compare;
+
+	t->array = cht_array_new(CHT_MIN_BITS);
+	if (!t->array) {
+		r = -ENOMEM;
+		goto err_free;
+	}
+
+	r = pthread_mutex_init(&t->lock, NULL);
+	if (r) {
+		r = -r;
+		goto err_array;
+	}
+
+	r = pthread_mutex_init(&t->sync_lock, NULL);
+	if (r) {
+		r = -r;
+		goto err_lock;
+	}
+
+	*out = t;
+	return 0;
+
+err_lock:
+	pthread_mutex_destroy(&t->lock);
+err_array:
+	free(t->array);
+err_free:
+	free(t);
+	return r;
+}
+
+static void cht_free_retired(struct cht_array *a)
+{
+	struct cht_array *next;
+
+	for ( ; a; a = next) {
+		next = a->next;
+		free(a);
+	}
+}
+
+void shl_chtable_free(struct shl_chtable *t,
+		      void (*free_cb) (void *elem, void *ctx),
+		      void *ctx)
+{
+	struct cht_array *a;
+	size_t i;
+	void *e;
+
+	if (!t)
+		return;
+
+	a = t->array;
+	if (free_cb) {
+		for (i = 0; i < ((size_t)1 << a->bits); ++i) {
+			e = a->slots[i].elem;
+			if (e && e != CHT_DELETED)
+				free_cb(e, ctx);
+		}
+	}
+
+	cht_free_retired(t->retired);
+	free(a);
+	pthread_mutex_destroy(&t->sync_lock);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+/*
+ * Read side
+ * The returned cookie remembers stripe and phase so unlock decrements the
+ * counter that lock incremented, even if the phase flipped in between.
+ */
+
+unsigned int shl_chtable_read_lock(struct shl_chtable *t)
+{
+	unsigned int s;
+	unsigned long p;
+
+	s = cht_stripe;
+	if (_shl_unlikely_(!s)) {
+		s = __atomic_add_fetch(&cht_next_stripe, 1, __ATOMIC_RELAXED);
+		s = s % CHT_STRIPES + 1;
+		cht_stripe = s;
+	}
+	--s;
+
+	p = __atomic_load_n(&t->phase, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&t->stripes[s].count[p], 1, __ATOMIC_SEQ_CST);
+
+	return s * 2 + p;
+}
+
+void shl_chtable_read_unlock(struct shl_chtable *t, unsigned int cookie)
+{
+	__atomic_sub_fetch(&t->stripes[cookie / 2].count[cookie % 2], 1,
+			   __ATOMIC_RELEASE);
+}
+
+bool shl_chtable_lookup(struct shl_chtable *t, const void *obj, size_t hash,
+			void **out)
+{
+	struct cht_array *a;
+	size_t i, mask, n;
+	void *e;
+
+	a = __atomic_load_n(&t->array, __ATOMIC_ACQUIRE);
+	mask = ((size_t)1 << a->bits) - 1;
+	i = cht_index(hash, a->bits);
+
+	for (n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+		e = __atomic_load_n(&a->slots[i].elem, __ATOMIC_ACQUIRE);
+		if (!e)
+			break;
+		if (e == CHT_DELETED)
+			continue;
+		if (__atomic_load_n(&a->slots[i].hash, __ATOMIC_RELAXED) != hash)
+			continue;
+		if (!t->compare(obj, e))
+			continue;
+
+		if (out)
+			*out = e;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Write side
+ * All of these run with @lock held. Slots of the published array are only
+ * written with atomic stores, a new array is filled with plain stores before
+ * it is published.
+ */
+
+static void cht_array_put(struct cht_array *a, size_t hash, void *elem)
+{
+	size_t i, mask;
+
+	mask = ((size_t)1 << a->bits) - 1;
+	i = cht_index(hash, a->bits);
+	while (a->slots[i].elem)
+		i = (i + 1) & mask;
+
+	a->slots[i].hash = hash;
+	a->slots[i].elem = elem;
+	++a->used;
+}
+
+/*
+ * Replace the published array by one with room for at least one more
+ * element. The new array is sized for a load of at most 1/2 right after the
+ * resize; if only deleted slots filled the old one, its size is kept.
+ */
+static int cht_resize(struct shl_chtable *t)
+{
+	struct cht_array *a, *old = t->array;
+	unsigned int bits = CHT_MIN_BITS;
+	size_t i;
+	void *e;
+
+	while (((size_t)1 << bits) < (t->elems + 1) * 2)
+		++bits;
+	if (bits < old->bits)
+		bits = old->bits;
+
+	a = cht_array_new(bits);
+	if (!a)
+		return -ENOMEM;
+
+	for (i = 0; i < ((size_t)1 << old->bits); ++i) {
+		e = old->slots[i].elem;
+		if (e && e != CHT_DELETED)
+			cht_array_put(a, old->slots[i].hash, e);
+	}
+
+	__atomic_store_n(&t->array, a, __ATOMIC_RELEASE);
+	old->next = t->retired;
+	t->retired = old;
+	return 0;
+}
+
+int shl_chtable_insert(struct shl_chtable *t, const void *obj, size_t hash,
+		       void **out)
+{
+	struct cht_array *a;
+	struct cht_slot *free_slot = NULL;
+	size_t i, mask, n;
+	void *e;
+	int r = 0;
+
+	pthread_mutex_lock(&t->lock);
+
+	a = t->array;
+	mask = ((size_t)1 << a->bits) - 1;
+	i = cht_index(hash, a->bits);
+
+	for (n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+		e = a->slots[i].elem;
+		if (!e)
+			break;
+		if (e == CHT_DELETED) {
+			if (!free_slot)
+				free_slot = &a->slots[i];
+			continue;
+		}
+		if (a->slots[i].hash == hash && t->compare(obj, e)) {
+			if (out)
+				*out = e;
+			r = -EALREADY;
+			goto out_unlock;
+		}
+	}
+
+	if (!free_slot) {
+		/* keep at least 1/4 of the slots empty so probes terminate */
+		if ((a->used + 1) * 4 > (mask + 1) * 3) {
+			r = cht_resize(t);
+			if (r)
+				goto out_unlock;
+			a = t->array;
+			mask = ((size_t)1 << a->bits) - 1;
+		}
+
+		i = cht_index(hash, a->bits);
+		while (a->slots[i].elem)
+			i = (i + 1) & mask;
+		free_slot = &a->slots[i];
+		++a->used;
+	}
+
+	__atomic_store_n(&free_slot->hash, hash, __ATOMIC_RELAXED);
+	__atomic_store_n(&free_slot->elem, (void*)obj, __ATOMIC_RELEASE);
+	++t->elems;
+	if (out)
+		*out = (void*)obj;
+
+out_unlock:
+	pthread_mutex_unlock(&t->lock);
+	return r;
+}
+
+bool shl_chtable_remove(struct shl_chtable *t, const void *obj, size_t hash,
+			void **out)
+{
+	struct cht_array *a;
+	size_t i, mask, n;
+	bool found = false;
+	void *e;
+
+	pthread_mutex_lock(&t->lock);
+
+	a = t->array;
+	mask = ((size_t)1 << a->bits) - 1;
+	i = cht_index(hash, a->bits);
+
+	for (n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+		e = a->slots[i].elem;
+		if (!e)
+			break;
+		if (e == CHT_DELETED || a->slots[i].hash != hash ||
+		    !t->compare(obj, e))
+			continue;
+
+		__atomic_store_n(&a->slots[i].elem, CHT_DELETED,
+				 __ATOMIC_RELEASE);
+		--t->elems;
+		if (out)
+			*out = e;
+		found = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&t->lock);
+	return found;
+}
+
+static void cht_flip(struct shl_chtable *t)
+{
+	unsigned long p;
+	unsigned int i;
+
+	/* order preceding unpublishing stores before the counter loads */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	p = __atomic_fetch_add(&t->phase, 1, __ATOMIC_SEQ_CST) & 1;
+
+	for (i = 0; i < CHT_STRIPES; ++i) {
+		while (__atomic_load_n(&t->stripes[i].count[p],
+				       __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+}
+
+void shl_chtable_synchronize(struct shl_chtable *t)
+{
+	struct cht_array *retired;
+
+	pthread_mutex_lock(&t->sync_lock);
+
+	pthread_mutex_lock(&t->lock);
+	retired = t->retired;
+	t->retired = NULL;
+	pthread_mutex_unlock(&t->lock);
+
+	/*
+	 * A reader may load the phase, stall, and increment the old counter
+	 * only after a single flip found it drained. It then counts against
+	 * the next phase, so a second flip is needed to wait for it.
+	 */
+	cht_flip(t);
+	cht_flip(t);
+
+	pthread_mutex_unlock(&t->sync_lock);
+
+	cht_free_retired(retired);
+}
+
+size_t shl_chtable_get_size(struct shl_chtable *t)
+{
+	size_t n;
+
+	pthread_mutex_lock(&t->lock);
+	n = t->elems;
+	pthread_mutex_unlock(&t->lock);
+
+	return n;
+}
@@ -0,0 +1,63 @@
+/*
+ * SHL - Concurrent hash-table
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Concurrent hash-table
+ * A read-mostly hash-table that can be shared between threads. Lookups take
+ * no locks and never wait, not even while the table is resized. Writers are
+ * serialized by an internal mutex. Like shl_htable, entries are allocated by
+ * the user and the table only stores pointers to them.
+ *
+ * Lookups must be done inside a read-side section:
+ *     c = shl_chtable_read_lock(t);
+ *     if (shl_chtable_lookup(t, &key, hash, &elem))
+ *         use(elem);
+ *     shl_chtable_read_unlock(t, c);
+ * An element found inside a section stays valid until the section ends, even
+ * if another thread removes it meanwhile. A removed element must therefore
+ * not be freed until shl_chtable_synchronize() returned, which waits for all
+ * sections that might still see it. Retired tables of past resizes are
+ * released there, too. Insert and remove may be called with or without a
+ * read-side section held, synchronize must not.
+ *
+ * Nothing in libtsm or gtktsm shares tables between threads yet, so
+ * shl-chtable.c is not part of the shl object library. Users build it
+ * themselves.
+ */
+
+#ifndef SHL_CHTABLE_H
+#define SHL_CHTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+struct shl_chtable;
+
+int shl_chtable_new(struct shl_chtable **out,
+		    bool (*compare) (const void *a, const void *b));
+void shl_chtable_free(struct shl_chtable *t,
+		      void (*free_cb) (void *elem, void *ctx),
+		      void *ctx);
+
+/* read side */
+
+unsigned int shl_chtable_read_lock(struct shl_chtable *t);
+void shl_chtable_read_unlock(struct shl_chtable *t, unsigned int cookie);
+bool shl_chtable_lookup(struct shl_chtable *t, const void *obj, size_t hash,
+			void **out);
+
+/* write side */
+
+int shl_chtable_insert(struct shl_chtable *t, const void *obj, size_t hash,
+		       void **out);
+bool shl_chtable_remove(struct shl_chtable *t, const void *obj, size_t hash,
+			void **out);
+void shl_chtable_synchronize(struct shl_chtable *t);
+size_t shl_chtable_get_size(struct shl_chtable *t);
+
+#endif  /* SHL_CHTABLE_H */
@@ -14,6 +14,9 @@
  *
  * At the end of the file you can find some helpers to use this htable to store
  * objects with "unsigned long" or "char*" keys.
+ *
+ * With SHL_HTABLE_SWISS defined, a SIMD-probed backend replaces the CCAN
+ * table behind the same API, see below.
  */
 
 #include <assert.h>
@@ -31,6 +34,8 @@
 #define COLD __attribute__((cold))
 #endif
 
+#ifndef SHL_HTABLE_SWISS
+
 struct htable {
 	/* KEEP IN SYNC WITH "struct shl_htable_int" */
 	size_t (*rehash)(const void *elem, void *priv);
@@ -400,6 +405,342 @@ bool shl_htable_remove(struct shl_htable *htable, const void *obj, size_t hash,
 	return false;
 }
 
+#else /* SHL_HTABLE_SWISS */
+
+/*
+ * SIMD-PROBED BACKEND
+ * Alternative implementation of the same API in the style of Swiss tables.
+ * The table keeps one control byte per slot next to an array of entry
+ * pointers. A control byte is either empty, deleted or holds 7 bits of the
+ * entry hash. Slots are probed in aligned groups of 16: one SSE2 compare
+ * (or a scalar loop without SSE2) finds all slots of a group whose control
+ * byte matches, so the compare callback only runs for likely hits and the
+ * pointers themselves are only touched then. Probing moves on group-wise
+ * and stops at the first group that has an empty slot.
+ * It reuses the members of "struct shl_htable_int": @bits is log2 of the
+ * number of slots, @max the number of used and deleted slots that triggers a
+ * resize and @table the allocation holding control bytes and entries, or
+ * &@perfect_bit while nothing is allocated.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SWISS_GROUP 16
+#define SWISS_EMPTY 0x80
+#define SWISS_DELETED 0xfe
+
+struct htable {
+	/* KEEP IN SYNC WITH "struct shl_htable_int" */
+	size_t (*rehash)(const void *elem, void *priv);
+	void *priv;
+	unsigned int bits;
+	size_t elems, deleted, max, max_with_deleted;
+	uintptr_t common_mask, common_bits;
+	uintptr_t perfect_bit;
+	uintptr_t *table;
+};
+
+static inline size_t swiss_size(const struct htable *ht)
+{
+	return ht->bits ? (size_t)1 << ht->bits : 0;
+}
+
+static inline uint8_t *swiss_ctrl(const struct htable *ht)
+{
+	return (uint8_t*)ht->table;
+}
+
+static inline void **swiss_slots(const struct htable *ht)
+{
+	return (void**)(swiss_ctrl(ht) + swiss_size(ht));
+}
+
+/* Spread the bits of weak hashes like the identity of unsigned longs. */
+static inline size_t swiss_mix(size_t hash)
+{
+#if SIZE_MAX > 0xffffffff
+	hash *= 0x9e3779b97f4a7c15ULL;
+	return hash ^ (hash >> 32);
+#else
+	hash *= 0x9e3779b9U;
+	return hash ^ (hash >> 16);
+#endif
+}
+
+/* Return a bit mask of the slots in the group at @ctrl that equal @c. */
+static inline unsigned int swiss_match(const uint8_t *ctrl, uint8_t c)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < SWISS_GROUP; ++i)
+		if (ctrl[i] == c)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+/* Return a bit mask of the empty or deleted slots in the group at @ctrl. */
+static inline unsigned int swiss_match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+	/* both have the top bit set, entries never do */
+	return _mm_movemask_epi8(g);
+#else
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < SWISS_GROUP; ++i)
+		if (ctrl[i] & 0x80)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+static void htable_init(struct htable *ht,
+			size_t (*rehash)(const void *elem, void *priv),
+			void *priv)
+{
+	memset(ht, 0, sizeof(*ht));
+	ht->rehash = rehash;
+	ht->priv = priv;
+	ht->common_mask = -1;
+	ht->table = &ht->perfect_bit;
+}
+
+/* Iterate @_off over all slots that hold an entry. */
+#define swiss_for_each(_ht, _off) \
+	for ((_off) = 0; (_off) < swiss_size(_ht); ++(_off)) \
+		if (!(swiss_ctrl(_ht)[(_off)] & 0x80))
+
+static void htable_clear(struct htable *ht,
+			 void (*free_cb) (void *entry, void *ctx),
+			 void *ctx)
+{
+	size_t i;
+
+	if (ht->bits) {
+		if (free_cb) {
+			swiss_for_each(ht, i)
+				free_cb(swiss_slots(ht)[i], ctx);
+		}
+
+		free(ht->table);
+	}
+
+	htable_init(ht, ht->rehash, ht->priv);
+}
+
+static void htable_visit(struct htable *ht,
+			 void (*visit_cb) (void *elem, void *ctx),
+			 void *ctx)
+{
+	size_t i;
+
+	if (visit_cb && ht->bits) {
+		swiss_for_each(ht, i)
+			visit_cb(swiss_slots(ht)[i], ctx);
+	}
+}
+
+/* Find a free slot for @hash. The table must have one. */
+static size_t swiss_find_free(const struct htable *ht, size_t hash)
+{
+	size_t groups_mask, g, step;
+	unsigned int mask;
+
+	groups_mask = (swiss_size(ht) / SWISS_GROUP) - 1;
+	g = (hash >> 7) & groups_mask;
+
+	for (step = 1; ; g = (g + step++) & groups_mask) {
+		mask = swiss_match_free(&swiss_ctrl(ht)[g * SWISS_GROUP]);
+		if (mask)
+			return g * SWISS_GROUP + __builtin_ctz(mask);
+	}
+}
+
+static COLD bool swiss_resize(struct htable *ht, unsigned int bits)
+{
+	struct htable old = *ht;
+	size_t i, pos, hash;
+	size_t size = (size_t)1 << bits;
+	void *table;
+
+	table = malloc(size + size * sizeof(void*));
+	if (!table)
+		return false;
+
+	memset(table, SWISS_EMPTY, size);
+	ht->table = table;
+	ht->bits = bits;
+	ht->deleted = 0;
+	ht->max = size / 8 * 7;
+
+	if (old.bits) {
+		swiss_for_each(&old, i) {
+			hash = swiss_mix(ht->rehash(swiss_slots(&old)[i],
+						    ht->priv));
+			pos = swiss_find_free(ht, hash);
+			swiss_ctrl(ht)[pos] = hash & 0x7f;
+			swiss_slots(ht)[pos] = swiss_slots(&old)[i];
+		}
+		free(old.table);
+	}
+
+	return true;
+}
+
+static bool htable_add(struct htable *ht, size_t hash, const void *p)
+{
+	unsigned int bits;
+	size_t pos;
+
+	if (ht->elems + ht->deleted + 1 > ht->max) {
+		/* grow if mostly live, otherwise just drop deleted slots */
+		bits = ht->bits ? ht->bits : 4;
+		if ((ht->elems + 1) * 16 > ht->max * 9 || !ht->bits)
+			bits = ht->bits ? ht->bits + 1 : 4;
+		if (!swiss_resize(ht, bits))
+			return false;
+	}
+
+	hash = swiss_mix(hash);
+	pos = swiss_find_free(ht, hash);
+	if (swiss_ctrl(ht)[pos] == SWISS_DELETED)
+		--ht->deleted;
+	swiss_ctrl(ht)[pos] = hash & 0x7f;
+	swiss_slots(ht)[pos] = (void*)p;
+	++ht->elems;
+	return true;
+}
+
+/* Find the slot of an entry matching @obj or return false. */
+static bool swiss_find(const struct shl_htable *htable, const struct htable *ht,
+		       const void *obj, size_t hash, size_t *out)
+{
+	size_t groups_mask, g, step, pos;
+	const uint8_t *ctrl;
+	unsigned int mask;
+
+	if (!ht->bits)
+		return false;
+
+	hash = swiss_mix(hash);
+	groups_mask = (swiss_size(ht) / SWISS_GROUP) - 1;
+	g = (hash >> 7) & groups_mask;
+
+	for (step = 1; ; g = (g + step++) & groups_mask) {
+		ctrl = &swiss_ctrl(ht)[g * SWISS_GROUP];
+
+		for (mask = swiss_match(ctrl, hash & 0x7f); mask;
+		     mask &= mask - 1) {
+			pos = g * SWISS_GROUP + __builtin_ctz(mask);
+			if (htable->compare(obj, swiss_slots(ht)[pos])) {
+				*out = pos;
+				return true;
+			}
+		}
+
+		if (swiss_match(ctrl, SWISS_EMPTY))
+			return false;
+
+		/* every group was visited, happens with deleted slots only */
+		if (step > groups_mask)
+			return false;
+	}
+}
+
+/*
+ * Wrapper code to make it easier to use this hash-table as map.
+ */
+
+void shl_htable_init(struct shl_htable *htable,
+		     bool (*compare) (const void *a, const void *b),
+		     size_t (*rehash)(const void *elem, void *priv),
+		     void *priv)
+{
+	struct htable *ht = (void*)&htable->htable;
+
+	htable->compare = compare;
+	htable_init(ht, rehash, priv);
+}
+
+void shl_htable_clear(struct shl_htable *htable,
+		      void (*free_cb) (void *elem, void *ctx),
+		      void *ctx)
+{
+	struct htable *ht = (void*)&htable->htable;
+
+	htable_clear(ht, free_cb, ctx);
+}
+
+void shl_htable_visit(struct shl_htable *htable,
+		      void (*visit_cb) (void *elem, void *ctx),
+		      void *ctx)
+{
+	struct htable *ht = (void*)&htable->htable;
+
+	htable_visit(ht, visit_cb, ctx);
+}
+
+bool shl_htable_lookup(struct shl_htable *htable, const void *obj, size_t hash,
+		       void **out)
+{
+	struct htable *ht = (void*)&htable->htable;
+	size_t pos;
+
+	if (!swiss_find(htable, ht, obj, hash, &pos))
+		return false;
+
+	if (out)
+		*out = swiss_slots(ht)[pos];
+	return true;
+}
+
+int shl_htable_insert(struct shl_htable *htable, const void *obj, size_t hash)
+{
+	struct htable *ht = (void*)&htable->htable;
+	bool b;
+
+	b = htable_add(ht, hash, (void*)obj);
+	return b ? 0 : -ENOMEM;
+}
+
+bool shl_htable_remove(struct shl_htable *htable, const void *obj, size_t hash,
+		       void **out)
+{
+	struct htable *ht = (void*)&htable->htable;
+	size_t pos;
+	uint8_t *group;
+
+	if (!swiss_find(htable, ht, obj, hash, &pos))
+		return false;
+
+	if (out)
+		*out = swiss_slots(ht)[pos];
+
+	/* Lookups stop at groups with an empty slot. If the group already has
+	 * one, no entry was pushed past it and the slot can be empty, too. */
+	group = &swiss_ctrl(ht)[pos & ~(size_t)(SWISS_GROUP - 1)];
+	if (swiss_match(group, SWISS_EMPTY)) {
+		swiss_ctrl(ht)[pos] = SWISS_EMPTY;
+	} else {
+		swiss_ctrl(ht)[pos] = SWISS_DELETED;
+		++ht->deleted;
+	}
+	--ht->elems;
+	return true;
+}
+
+#endif /* SHL_HTABLE_SWISS */
+
 /*
  * Helpers
  */
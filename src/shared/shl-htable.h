@@ -13,7 +13,9 @@
  * maintenance-members need to be embedded in user-allocated objects. However,
  * the key (and optionally the hash) must be stored in the objects.
  *
- * Uses internally the htable from CCAN. See LICENSE_htable.
+ * Uses internally the htable from CCAN. See LICENSE_htable. When built with
+ * SHL_HTABLE_SWISS, a SIMD-probed open-addressing table is used instead; the
+ * API and struct layout are the same for both.
  */
 
 #ifndef SHL_HTABLE_H
@@ -65,8 +65,14 @@ struct shl_pty {
 	char in_buf[SHL_PTY_BUFSIZE];
 	struct shl_ring out_buf;
 
+	struct shl_ring in_ring;	/* input-ring mode if @in_limit > 0 */
+	size_t in_limit;		/* max bytes held in @in_ring */
+	size_t in_chunk;		/* size of the next read into @in_ring */
+
 	shl_pty_input_fn fn_input;
 	void *fn_input_data;
+
+	int bridge;			/* bridge we are added to or -1 */
 };
 
 enum shl_pty_msg {
@@ -204,6 +210,7 @@ pid_t shl_pty_open(struct shl_pty **out,
 
 	pty->ref = 1;
 	pty->fd = -1;
+	pty->bridge = -1;
 	pty->fn_input = fn_input;
 	pty->fn_input_data = fn_input_data;
 
@@ -282,6 +289,7 @@ void shl_pty_unref(struct shl_pty *pty)
 		return;
 
 	shl_pty_close(pty);
+	shl_ring_clear(&pty->in_ring);
 	shl_ring_clear(&pty->out_buf);
 	free(pty);
 }
@@ -293,6 +301,7 @@ void shl_pty_close(struct shl_pty *pty)
 
 	close(pty->fd);
 	pty->fd = -1;
+	pty->bridge = -1;
 }
 
 bool shl_pty_is_open(struct shl_pty *pty)
@@ -390,6 +399,165 @@ static int pty_read(struct shl_pty *pty)
 	return -EAGAIN;
 }
 
+/*
+ * Input ring
+ * Instead of reading into the fixed @in_buf and calling fn_input for every
+ * read, the input-ring mode reads straight into a growable ring with
+ * readv(). The read size starts at SHL_PTY_BUFSIZE and doubles while reads
+ * come back full, so floods are drained with few, large reads; it shrinks
+ * again once reads come back mostly empty. A short read means the queue is
+ * drained, the next write of the child triggers a new edge.
+ *
+ * With fn_input set, all data read during one dispatch is passed to it in a
+ * single call and the ring is emptied again. @in_limit then caps the bytes
+ * read per dispatch; if it is hit, -EAGAIN is returned like pty_read() does.
+ *
+ * Without fn_input, data stays in the ring until the caller consumes it via
+ * shl_pty_peek_input() and shl_pty_pull_input(). The ring is mirrored if
+ * possible, so peek returns a single span. Once the ring holds @in_limit
+ * bytes, reading stops and -ENOBUFS is returned; dispatch the pty again after
+ * pulling data.
+ *
+ * The ring only grows while reading. The read size decays on short reads and
+ * while the pty is idle. Once it is back at SHL_PTY_BUFSIZE and the ring is
+ * empty, a ring grown by a flood is released
+ * and starts over at SHL_PTY_BUFSIZE, so idle ptys do not keep their peak.
+ */
+
+static void pty_shrink_ring(struct shl_pty *pty)
+{
+	if (pty->in_chunk > SHL_PTY_BUFSIZE ||
+	    pty->in_ring.size <= SHL_PTY_BUFSIZE ||
+	    shl_ring_get_size(&pty->in_ring))
+		return;
+
+	shl_ring_clear(&pty->in_ring);
+	if (!pty->fn_input)
+		shl_ring_init_mirror(&pty->in_ring, SHL_PTY_BUFSIZE);
+}
+
+static int pty_read_ring(struct shl_pty *pty)
+{
+	struct iovec vec[2];
+	size_t room, want;
+	ssize_t len;
+	int r, num;
+
+	pty_shrink_ring(pty);
+
+	for (;;) {
+		room = pty->in_limit - shl_ring_get_size(&pty->in_ring);
+		if (!room) {
+			r = pty->fn_input ? -EAGAIN : -ENOBUFS;
+			break;
+		}
+
+		want = pty->in_chunk < room ? pty->in_chunk : room;
+		num = shl_ring_reserve(&pty->in_ring, want, vec);
+		if (num < 0) {
+			r = num;
+			break;
+		}
+
+		/* do not read more than @want even if the ring has room */
+		if (vec[0].iov_len >= want) {
+			vec[0].iov_len = want;
+			num = 1;
+		} else {
+			vec[1].iov_len = want - vec[0].iov_len;
+		}
+
+		len = readv(pty->fd, vec, num);
+		if (len < 0) {
+			if (errno == EAGAIN) {
+				/* an idle pty decays, too */
+				if (pty->in_chunk > SHL_PTY_BUFSIZE)
+					pty->in_chunk /= 2;
+				r = 0;
+			} else if (errno == EINTR) {
+				r = -EAGAIN;
+			} else {
+				r = -errno;
+			}
+			break;
+		} else if (!len) {
+			r = -EPIPE;
+			break;
+		}
+
+		shl_ring_commit(&pty->in_ring, (size_t)len);
+
+		if ((size_t)len == want) {
+			if (pty->in_chunk < pty->in_limit / 2)
+				pty->in_chunk *= 2;
+		} else {
+			if ((size_t)len < want / 2 &&
+			    pty->in_chunk > SHL_PTY_BUFSIZE)
+				pty->in_chunk /= 2;
+			r = 0;
+			break;
+		}
+	}
+
+	if (pty->fn_input) {
+		/* reads of one dispatch start at offset 0 and never wrap */
+		num = shl_ring_peek(&pty->in_ring, vec);
+		if (num > 0)
+			pty->fn_input(pty,
+				      pty->fn_input_data,
+				      vec[0].iov_base,
+				      vec[0].iov_len);
+		shl_ring_flush(&pty->in_ring);
+	}
+
+	pty_shrink_ring(pty);
+	return r;
+}
+
+int shl_pty_set_input_ring(struct shl_pty *pty, size_t limit)
+{
+	if (!pty)
+		return -EINVAL;
+
+	if (!limit) {
+		if (shl_ring_get_size(&pty->in_ring))
+			return -EBUSY;
+
+		shl_ring_clear(&pty->in_ring);
+		pty->in_limit = 0;
+		return 0;
+	}
+
+	if (limit < SHL_PTY_BUFSIZE)
+		limit = SHL_PTY_BUFSIZE;
+
+	if (!pty->in_limit) {
+		pty->in_chunk = SHL_PTY_BUFSIZE;
+		/* a plain ring works, too, it just splits peeked data */
+		if (!pty->fn_input)
+			shl_ring_init_mirror(&pty->in_ring, SHL_PTY_BUFSIZE);
+	}
+
+	pty->in_limit = limit;
+	return 0;
+}
+
+size_t shl_pty_peek_input(struct shl_pty *pty, struct iovec *vec)
+{
+	if (!pty)
+		return 0;
+
+	return shl_ring_peek(&pty->in_ring, vec);
+}
+
+void shl_pty_pull_input(struct shl_pty *pty, size_t size)
+{
+	if (!pty)
+		return;
+
+	shl_ring_pull(&pty->in_ring, size);
+}
+
 int shl_pty_dispatch(struct shl_pty *pty)
 {
 	int r;
@@ -397,7 +565,10 @@ int shl_pty_dispatch(struct shl_pty *pty)
 	if (!shl_pty_is_open(pty))
 		return -ENODEV;
 
-	r = pty_read(pty);
+	if (pty->in_limit)
+		r = pty_read_ring(pty);
+	else
+		r = pty_read(pty);
 	pty_write(pty);
 	return r;
 }
@@ -467,16 +638,19 @@ void shl_pty_bridge_free(int bridge)
 	close(bridge);
 }
 
-int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty)
+/*
+ * Dispatch @pty and re-arm it if it still has data pending. The fd stays in
+ * the epoll-set, so EPOLL_CTL_MOD makes epoll re-check it and queue it at the
+ * end of the ready-list if it is readable. Returns the result of
+ * shl_pty_dispatch().
+ */
+static int bridge_dispatch_one(int bridge, struct shl_pty *pty)
 {
 	struct epoll_event up;
 	int r;
 
-	if (bridge < 0 || !pty)
-		return -EINVAL;
-
 	r = shl_pty_dispatch(pty);
-	if (r == -EAGAIN) {
+	if (r == -EAGAIN && pty->bridge == bridge) {
 		/* EAGAIN means we couldn't dispatch data fast enough. Modify
 		 * the fd in the epoll-set so we get edge-triggered events
 		 * next round. */
@@ -484,36 +658,96 @@ int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty)
 		up.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT | EPOLLET;
 		up.data.ptr = pty;
 		epoll_ctl(bridge,
-			  EPOLL_CTL_ADD,
+			  EPOLL_CTL_MOD,
 			  shl_pty_get_fd(pty),
 			  &up);
 	}
 
+	return r;
+}
+
+int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty)
+{
+	if (bridge < 0 || !pty)
+		return -EINVAL;
+
+	bridge_dispatch_one(bridge, pty);
 	return 0;
 }
 
-int shl_pty_bridge_dispatch(int bridge, int timeout)
+/*
+ * Wait up to @timeout for ready ptys and dispatch up to @max of them with a
+ * single epoll_wait(). A pty that returns -EAGAIN is re-armed and thus goes
+ * to the back of the ready-list, behind all ptys that were ready before, so
+ * busy ptys are served round-robin rather than starving each other. Ready
+ * ptys beyond @max stay at the front of the list for the next call.
+ *
+ * The batch holds a reference to each of its ptys, so callbacks may remove,
+ * close or drop other ptys of the same bridge. Those are skipped when their
+ * turn comes. Returns the number of dispatched ptys or a negative error code;
+ * if @stats is given, it is filled in either way.
+ */
+int shl_pty_bridge_dispatch_n(int bridge, int timeout, unsigned int max,
+			      struct shl_pty_bridge_stats *stats)
 {
-	struct epoll_event ev;
+	struct epoll_event ev[SHL_PTY_BRIDGE_MAX_EVENTS];
+	struct shl_pty_bridge_stats st;
 	struct shl_pty *pty;
-	int r;
+	int r, i, n;
+
+	memset(&st, 0, sizeof(st));
+	if (stats)
+		*stats = st;
 
 	if (bridge < 0)
 		return -EINVAL;
 
-	r = epoll_wait(bridge, &ev, 1, timeout);
-	if (r < 0) {
+	if (!max)
+		max = 1;
+	else if (max > SHL_PTY_BRIDGE_MAX_EVENTS)
+		max = SHL_PTY_BRIDGE_MAX_EVENTS;
+
+	n = epoll_wait(bridge, ev, (int)max, timeout);
+	if (n < 0) {
 		if (errno == EAGAIN || errno == EINTR)
 			return 0;
 
 		return -errno;
 	}
 
-	if (!r)
-		return 0;
+	for (i = 0; i < n; ++i)
+		shl_pty_ref(ev[i].data.ptr);
+
+	for (i = 0; i < n; ++i) {
+		pty = ev[i].data.ptr;
+
+		/* removed, closed or dropped by an earlier callback */
+		if (pty->bridge != bridge || pty->ref < 2)
+			continue;
+
+		r = bridge_dispatch_one(bridge, pty);
+		++st.dispatched;
+		if (r == -EAGAIN)
+			++st.again;
+		else if (r < 0 && r != -ENOBUFS)
+			++st.failed;
+	}
+
+	for (i = 0; i < n; ++i)
+		shl_pty_unref(ev[i].data.ptr);
+
+	if (stats)
+		*stats = st;
+
+	return st.dispatched;
+}
+
+int shl_pty_bridge_dispatch(int bridge, int timeout)
+{
+	int r;
 
-	pty = ev.data.ptr;
-	return shl_pty_bridge_dispatch_pty(bridge, pty);
+	r = shl_pty_bridge_dispatch_n(bridge, timeout, 1, NULL);
+	return r < 0 ? r : 0;
 }
 
 int shl_pty_bridge_add(int bridge, struct shl_pty *pty)
@@ -537,6 +771,7 @@ int shl_pty_bridge_add(int bridge, struct shl_pty *pty)
 	if (r < 0)
 		return -errno;
 
+	pty->bridge = bridge;
 	return 0;
 }
 
@@ -549,4 +784,6 @@ void shl_pty_bridge_remove(int bridge, struct shl_pty *pty)
 		  EPOLL_CTL_DEL,
 		  shl_pty_get_fd(pty),
 		  NULL);
+	if (pty->bridge == bridge)
+		pty->bridge = -1;
 }
@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "shl-macro.h"
 
@@ -50,6 +51,12 @@ int shl_pty_get_fd(struct shl_pty *pty);
 pid_t shl_pty_get_child(struct shl_pty *pty);
 
 int shl_pty_dispatch(struct shl_pty *pty);
+
+/* read into a growable ring, see shl-pty.c; @limit of 0 turns it off */
+int shl_pty_set_input_ring(struct shl_pty *pty, size_t limit);
+size_t shl_pty_peek_input(struct shl_pty *pty, struct iovec *vec);
+void shl_pty_pull_input(struct shl_pty *pty, size_t size);
+
 int shl_pty_write(struct shl_pty *pty, const char *u8, size_t len);
 int shl_pty_signal(struct shl_pty *pty, int sig);
 int shl_pty_resize(struct shl_pty *pty,
@@ -58,11 +65,21 @@ int shl_pty_resize(struct shl_pty *pty,
 
 /* pty bridge */
 
+#define SHL_PTY_BRIDGE_MAX_EVENTS 256
+
+struct shl_pty_bridge_stats {
+	unsigned int dispatched;	/* ptys dispatched */
+	unsigned int again;		/* of those, re-armed with data left */
+	unsigned int failed;		/* of those, failed (e.g. -EPIPE) */
+};
+
 int shl_pty_bridge_new(void);
 void shl_pty_bridge_free(int bridge);
 
 int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty);
 int shl_pty_bridge_dispatch(int bridge, int timeout);
+int shl_pty_bridge_dispatch_n(int bridge, int timeout, unsigned int max,
+			      struct shl_pty_bridge_stats *stats);
 int shl_pty_bridge_add(int bridge, struct shl_pty *pty);
 void shl_pty_bridge_remove(int bridge, struct shl_pty *pty);
 
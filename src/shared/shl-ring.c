@@ -12,7 +12,9 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
+#include <unistd.h>
 #include "shl-macro.h"
 #include "shl-ring.h"
 
@@ -26,10 +28,145 @@ void shl_ring_flush(struct shl_ring *r)
 
 void shl_ring_clear(struct shl_ring *r)
 {
-	free(r->buf);
+	if (r->mirror) {
+		if (r->buf)
+			munmap(r->buf, r->size * 2);
+		close(r->fd);
+	} else {
+		free(r->buf);
+	}
+
 	memset(r, 0, sizeof(*r));
 }
 
+/*
+ * Mirrored rings
+ * The buffer is a memfd of @size bytes mapped twice into one reservation of
+ * 2 * @size bytes, so @buf[i] and @buf[i + size] are the same byte. Data that
+ * wraps at the end of the first mapping simply continues into the second
+ * one. Sizes are powers of two of at least a page, which keeps RING_MASK()
+ * working and satisfies mmap() alignment.
+ */
+
+static int ring_map_mirror(int fd, size_t size, uint8_t **out)
+{
+	uint8_t *base;
+	void *p;
+	int r;
+
+	base = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	p = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 fd, 0);
+	if (p == MAP_FAILED)
+		goto err_unmap;
+
+	p = mmap(base + size, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED)
+		goto err_unmap;
+
+	*out = base;
+	return 0;
+
+err_unmap:
+	r = -errno;
+	munmap(base, size * 2);
+	return r;
+}
+
+static size_t ring_mirror_size(size_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (page > 0 && size < (size_t)page)
+		size = page;
+
+	return SHL_ALIGN_POWER2(size);
+}
+
+int shl_ring_init_mirror(struct shl_ring *r, size_t size)
+{
+#ifdef BUILD_HAVE_MEMFD_CREATE
+	uint8_t *buf;
+	int fd, err;
+
+	if (r->buf || r->mirror)
+		return -EBUSY;
+
+	size = ring_mirror_size(size ? size : 4096);
+	if (size == 0)
+		return -ENOMEM;
+
+	fd = memfd_create("shl-ring", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size) < 0) {
+		err = -errno;
+		goto err_close;
+	}
+
+	err = ring_map_mirror(fd, size, &buf);
+	if (err < 0)
+		goto err_close;
+
+	r->buf = buf;
+	r->size = size;
+	r->start = 0;
+	r->used = 0;
+	r->mirror = true;
+	r->fd = fd;
+	return 0;
+
+err_close:
+	close(fd);
+	return err;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * Grow a mirrored ring to @nsize bytes. The file is extended and mapped
+ * anew; bytes at offsets below the old size keep their contents. If the data
+ * wrapped, only the smaller of its two pieces is moved to make it contiguous
+ * again under the new size.
+ */
+static int ring_resize_mirror(struct shl_ring *r, size_t nsize)
+{
+	uint8_t *buf;
+	size_t head, tail;
+	int err;
+
+	if (ftruncate(r->fd, nsize) < 0)
+		return -errno;
+
+	err = ring_map_mirror(r->fd, nsize, &buf);
+	if (err < 0)
+		return err;
+
+	if (r->start + r->used > r->size) {
+		head = r->size - r->start;
+		tail = r->used - head;
+		if (tail <= head) {
+			memcpy(&buf[r->size], buf, tail);
+		} else {
+			memcpy(&buf[nsize - head], &buf[r->start], head);
+			r->start = nsize - head;
+		}
+	}
+
+	munmap(r->buf, r->size * 2);
+	r->buf = buf;
+	r->size = nsize;
+
+	return 0;
+}
+
 /*
  * Get data pointers for current ring-buffer data. @vec must be an array of 2
  * iovec objects. They are filled according to the data available in the
@@ -46,7 +183,7 @@ size_t shl_ring_peek(struct shl_ring *r, struct iovec *vec)
 {
 	if (r->used == 0) {
 		return 0;
-	} else if (r->start + r->used <= r->size) {
+	} else if (r->mirror || r->start + r->used <= r->size) {
 		if (vec) {
 			vec[0].iov_base = &r->buf[r->start];
 			vec[0].iov_len = r->used;
@@ -77,7 +214,7 @@ size_t shl_ring_copy(struct shl_ring *r, void *buf, size_t size)
 
 	if (size > 0) {
 		l = r->size - r->start;
-		if (size <= l) {
+		if (size <= l || r->mirror) {
 			memcpy(buf, &r->buf[r->start], size);
 		} else {
 			memcpy(buf, &r->buf[r->start], l);
@@ -97,6 +234,9 @@ static int ring_resize(struct shl_ring *r, size_t nsize)
 	uint8_t *buf;
 	size_t l;
 
+	if (r->mirror)
+		return ring_resize_mirror(r, nsize);
+
 	buf = malloc(nsize);
 	if (!buf)
 		return -ENOMEM;
@@ -162,7 +302,7 @@ int shl_ring_push(struct shl_ring *r, const void *u8, size_t size)
 
 	pos = RING_MASK(r, r->start + r->used);
 	l = r->size - pos;
-	if (l >= size) {
+	if (l >= size || r->mirror) {
 		memcpy(&r->buf[pos], u8, size);
 	} else {
 		memcpy(&r->buf[pos], u8, l);
@@ -174,6 +314,53 @@ int shl_ring_push(struct shl_ring *r, const void *u8, size_t size)
 	return 0;
 }
 
+/*
+ * Get pointers to the free space of the ring, after making sure it can take
+ * at least @size more bytes. @vec must be an array of 2 iovec objects; the
+ * number of filled ones is returned, or -ENOMEM on OOM. Free space of an
+ * empty ring always starts at the beginning of the buffer, and that of a
+ * mirrored ring is always contiguous. Data written there becomes part of the
+ * ring with shl_ring_commit().
+ */
+int shl_ring_reserve(struct shl_ring *r, size_t size, struct iovec *vec)
+{
+	size_t pos, avail;
+	int err;
+
+	err = ring_grow(r, size ? size : 1);
+	if (err < 0)
+		return err;
+
+	if (r->used == 0)
+		r->start = 0;
+
+	pos = RING_MASK(r, r->start + r->used);
+	avail = r->size - r->used;
+	if (r->mirror || pos + avail <= r->size) {
+		vec[0].iov_base = &r->buf[pos];
+		vec[0].iov_len = avail;
+		return 1;
+	}
+
+	vec[0].iov_base = &r->buf[pos];
+	vec[0].iov_len = r->size - pos;
+	vec[1].iov_base = r->buf;
+	vec[1].iov_len = avail - (r->size - pos);
+	return 2;
+}
+
+/*
+ * Append @size bytes to the ring that the caller wrote into the space
+ * returned by shl_ring_reserve(). Committing more than is free is clamped.
+ */
+void shl_ring_commit(struct shl_ring *r, size_t size)
+{
+	if (size > r->size - r->used)
+		size = r->size - r->used;
+
+	r->used += size;
+}
+
 /*
  * Remove @len bytes from the start of the ring-buffer. Note that we protect
  * against overflows so removing more bytes than available is safe.
@@ -7,6 +7,10 @@
 
 /*
  * Ring buffer
+ * By default the buffer wraps at its end, so the data may be split into two
+ * pieces. A mirrored ring maps the same pages twice back to back instead;
+ * every span of data is then contiguous in memory and growing the buffer
+ * remaps the pages rather than copying them.
  */
 
 #ifndef SHL_RING_H
@@ -14,6 +18,7 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
@@ -23,15 +28,20 @@ struct shl_ring {
 	size_t size;		/* actual size of @buf */
 	size_t start;		/* start position of ring */
 	size_t used;		/* number of actually used bytes */
+	bool mirror;		/* @buf is mapped twice, @size bytes apart */
+	int fd;			/* memfd backing @buf if @mirror */
 };
 
+/* switch an empty ring into mirrored mode with room for @size bytes */
+int shl_ring_init_mirror(struct shl_ring *r, size_t size);
+
 /* flush buffer so it is empty again */
 void shl_ring_flush(struct shl_ring *r);
 
 /* flush buffer, free allocated data and reset to initial state */
 void shl_ring_clear(struct shl_ring *r);
 
-/* get pointers to buffer data and their length */
+/* get pointers to buffer data and their length, a mirrored ring fills one */
 size_t shl_ring_peek(struct shl_ring *r, struct iovec *vec);
 
 /* copy data into external linear buffer */
@@ -40,6 +50,12 @@ size_t shl_ring_copy(struct shl_ring *r, void *buf, size_t size);
 /* push data to the end of the buffer */
 int shl_ring_push(struct shl_ring *r, const void *u8, size_t size);
 
+/* get pointers to free space for at least @size more bytes, growing if needed */
+int shl_ring_reserve(struct shl_ring *r, size_t size, struct iovec *vec);
+
+/* append @size bytes that were written into reserved space */
+void shl_ring_commit(struct shl_ring *r, size_t size);
+
 /* pull data from the front of the buffer */
 void shl_ring_pull(struct shl_ring *r, size_t size);
 
@@ -49,10 +49,26 @@ struct tsm_symbol_table;
 
 extern const tsm_symbol_t tsm_symbol_default;
 
+struct tsm_symbol_stats {
+	size_t entries;			/* symbols in the table */
+	size_t marked;			/* symbols marked by the last mark pass */
+	size_t free_ids;		/* IDs waiting for reuse */
+	size_t bytes;
+	unsigned long collections;
+};
+
 int tsm_symbol_table_new(struct tsm_symbol_table **out);
 void tsm_symbol_table_ref(struct tsm_symbol_table *tbl);
 void tsm_symbol_table_unref(struct tsm_symbol_table *tbl);
 
+bool tsm_symbol_table_gc_due(struct tsm_symbol_table *tbl);
+unsigned long tsm_symbol_table_get_epoch(struct tsm_symbol_table *tbl);
+int tsm_symbol_table_mark_begin(struct tsm_symbol_table *tbl);
+void tsm_symbol_table_mark(struct tsm_symbol_table *tbl, tsm_symbol_t sym);
+unsigned int tsm_symbol_table_sweep(struct tsm_symbol_table *tbl);
+void tsm_symbol_table_get_stats(struct tsm_symbol_table *tbl,
+				struct tsm_symbol_stats *stats);
+
 tsm_symbol_t tsm_symbol_make(uint32_t ucs4);
 tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4);
@@ -61,6 +77,40 @@ const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 unsigned int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
 				  tsm_symbol_t sym);
 
+/* character classes; values are shared with tsm-unicode-gen.c */
+
+enum tsm_uclass {
+	TSM_UCLASS_SPACE,
+	TSM_UCLASS_WORD,
+	TSM_UCLASS_PUNCT,
+	TSM_UCLASS_CJK,
+};
+
+unsigned int tsm_ucs4_get_class(uint32_t ucs4);
+
+/* grapheme break properties (UAX #29); shared with tsm-unicode-gen.c */
+
+enum tsm_gbp {
+	TSM_GBP_OTHER,
+	TSM_GBP_CR,
+	TSM_GBP_LF,
+	TSM_GBP_CONTROL,
+	TSM_GBP_EXTEND,
+	TSM_GBP_ZWJ,
+	TSM_GBP_RI,
+	TSM_GBP_PREPEND,
+	TSM_GBP_SPACINGMARK,
+	TSM_GBP_L,
+	TSM_GBP_V,
+	TSM_GBP_T,
+	TSM_GBP_LV,
+	TSM_GBP_LVT,
+	TSM_GBP_EXTPICT,
+	TSM_GBP_NONE,			/* start of text, never in the table */
+};
+
+unsigned int tsm_ucs4_get_gbp(uint32_t ucs4);
+
 /* utf8 state machine */
 
 struct tsm_utf8_mach {
@@ -96,16 +146,22 @@ struct line {
 	struct line *prev;		/* prev line (NULL if not sb) */
 
 	unsigned int size;		/* real width */
+	unsigned int wrapped : 1;	/* soft-wrapped into the next line */
 	struct cell *cells;		/* actuall cells */
 	uint64_t sb_id;			/* sb ID */
 	tsm_age_t age;			/* age of the whole line */
+	tsm_age_t cell_age;		/* age of the youngest cell */
+	uint64_t hash;			/* cached content hash */
+	tsm_age_t hash_age;		/* cell_age when hash was computed */
+	unsigned int hash_epoch;	/* age_epoch when hash was computed */
+	unsigned int hash_width;	/* size_x when hash was computed */
 };
 
-#define SELECTION_TOP -1
+struct screen_draw_pool;
+
 struct selection_pos {
-	struct line *line;
+	uint64_t id;			/* line id, see screen_line_id() */
 	unsigned int x;
-	int y;
 };
 
 struct tsm_screen {
@@ -122,6 +178,10 @@ struct tsm_screen {
 	/* ageing */
 	tsm_age_t age_cnt;		/* current age counter */
 	unsigned int age_reset : 1;	/* age-overflow flag */
+	unsigned int age_epoch;		/* number of age-overflows */
+	unsigned int dirty : 1;		/* changed since last draw */
+	tsm_screen_change_cb change_cb;	/* called when becoming dirty */
+	void *change_data;
 
 	/* current buffer */
 	unsigned int size_x;		/* width of screen */
@@ -140,7 +200,7 @@ struct tsm_screen {
 	struct line *sb_last;		/* last line; was moved last*/
 	unsigned int sb_max;		/* max-limit of lines in sb */
 	struct line *sb_pos;		/* current position in sb or NULL */
-	uint64_t sb_last_id;		/* last id given to sb-line */
+	uint64_t sb_last_id;		/* last id of a line scrolled off */
 
 	/* cursor: positions are always in-bound, but cursor_x might be
 	 * bigger than size_x if new-line is pending */
@@ -151,23 +211,101 @@ struct tsm_screen {
 	bool *tab_ruler;		/* tab-flag for all cells of one row */
 
 	/* selection */
+	uint32_t word_chars[4];		/* ASCII bitmap of extra word chars */
 	bool sel_active;
 	struct selection_pos sel_start;
 	struct selection_pos sel_end;
+
+	/* workers of tsm_screen_draw_parallel(), created on first use */
+	struct screen_draw_pool *draw_pool;
 };
 
 void screen_cell_init(struct tsm_screen *con, struct cell *cell);
 
+/*
+ * Every line has an absolute id: scroll-back lines their sb_id, row y of the
+ * active screen sb_last_id + 1 + y. Each line scrolling off the main screen
+ * takes the next id, whether it is kept in the scroll-back buffer or not, so
+ * ids of lines that were dropped sort before all remaining lines. Lines of
+ * the alternate screen never take ids. Rows keep their ids while their
+ * content moves, so selection anchors are moved explicitly.
+ */
+static inline uint64_t screen_line_id(const struct tsm_screen *con,
+				      unsigned int y)
+{
+	return con->sb_last_id + 1 + y;
+}
+
+static inline uint64_t screen_first_id(const struct tsm_screen *con)
+{
+	return con->sb_first ? con->sb_first->sb_id : screen_line_id(con, 0);
+}
+
+static inline bool screen_attr_equal(const struct tsm_screen_attr *a,
+				     const struct tsm_screen_attr *b)
+{
+	return a->fccode == b->fccode &&
+	       a->bccode == b->bccode &&
+	       a->fr == b->fr && a->fg == b->fg && a->fb == b->fb &&
+	       a->br == b->br && a->bg == b->bg && a->bb == b->bb &&
+	       a->bold == b->bold &&
+	       a->italic == b->italic &&
+	       a->underline == b->underline &&
+	       a->inverse == b->inverse &&
+	       a->protect == b->protect &&
+	       a->blink == b->blink;
+}
+
 void tsm_screen_set_opts(struct tsm_screen *scr, unsigned int opts);
 void tsm_screen_reset_opts(struct tsm_screen *scr, unsigned int opts);
 unsigned int tsm_screen_get_opts(struct tsm_screen *scr);
+void screen_append(struct tsm_screen *con, uint32_t ucs4);
+void screen_draw_pool_free(struct screen_draw_pool *pool);
+
+/* output helpers */
+
+struct screen_out {
+	struct tsm_screen *con;
+	tsm_screen_write_cb write_cb;
+	void *data;
+	size_t len;
+	char buf[4096];
+};
+
+void screen_out_flush(struct screen_out *o);
+void screen_out_put(struct screen_out *o, const char *u8, size_t len);
+void screen_out_str(struct screen_out *o, const char *str);
+void screen_out_uint(struct screen_out *o, unsigned int num);
+
+void screen_sgr_reset(struct tsm_screen_attr *attr);
+bool screen_sgr_fg_equal(const struct tsm_screen_attr *a,
+			 const struct tsm_screen_attr *b);
+bool screen_sgr_bg_equal(const struct tsm_screen_attr *a,
+			 const struct tsm_screen_attr *b);
+bool screen_sgr_equal(const struct tsm_screen_attr *a,
+		      const struct tsm_screen_attr *b);
+void screen_sgr_set(struct screen_out *o, struct tsm_screen_attr *cur,
+		    const struct tsm_screen_attr *attr);
 
 static inline void screen_inc_age(struct tsm_screen *con)
 {
 	if (++con->age_cnt == 0) {
 		con->age_reset = 1;
+		++con->age_epoch;
 		++con->age_cnt;
 	}
+
+	if (!con->dirty) {
+		con->dirty = 1;
+		if (con->change_cb)
+			con->change_cb(con, con->change_data);
+	}
+}
+
+/* re-arm the change callback after the screen was drawn or diffed */
+static inline void screen_mark_drawn(struct tsm_screen *con)
+{
+	con->dirty = 0;
 }
 
 /* available character sets */
@@ -123,6 +123,20 @@ size_t tsm_ucs4_get_len(uint32_t ucs4);
 size_t tsm_ucs4_to_utf8(uint32_t ucs4, char *out);
 char *tsm_ucs4_to_utf8_alloc(const uint32_t *ucs4, size_t len, size_t *len_out);
 
+/**
+ * @brief Encode a string of code points as UTF-8.
+ *
+ * The result is the same as calling tsm_ucs4_to_utf8() for each code point,
+ * but runs of ASCII and 2-byte characters are encoded in blocks.
+ *
+ * @param ucs4 Code points to encode.
+ * @param len Number of code points.
+ * @param out Buffer to write into, or NULL to only compute the size.
+ *
+ * @return Number of bytes written or needed, at most 4 * @p len.
+ */
+size_t tsm_ucs4_to_utf8_bulk(const uint32_t *ucs4, size_t len, char *out);
+
 /* symbols */
 
 typedef uint32_t tsm_symbol_t;
@@ -185,10 +199,80 @@ typedef int (*tsm_screen_draw_cb) (struct tsm_screen *con,
 				   tsm_age_t age,
 				   void *data);
 
+/**
+ * A horizontal run of cells with identical effective attributes.
+ *
+ * Selection, cursor and inverse-mode are already applied to @ref attr. Each
+ * cell contributes lens[i] code points to @ref ch and occupies widths[i]
+ * columns. Empty cells are passed as a single space, trailing cells of wide
+ * characters have width 0 and no code points. All pointers are only valid
+ * during the callback.
+ */
+struct tsm_screen_run {
+	const uint32_t *ch;		/* code points of all cells */
+	size_t len;			/* number of code points in @ch */
+	const uint8_t *widths;		/* width of each cell */
+	const uint8_t *lens;		/* number of code points of each cell */
+	unsigned int cells;		/* number of cells in the run */
+	unsigned int posx;		/* column of the first cell */
+	unsigned int posy;		/* row of the run */
+	struct tsm_screen_attr attr;	/* effective attributes */
+	tsm_age_t age;			/* age of the youngest cell */
+};
+
+typedef int (*tsm_screen_draw_run_cb) (struct tsm_screen *con,
+				       const struct tsm_screen_run *run,
+				       void *data);
+
+#define TSM_CELL_BOLD		0x0001
+#define TSM_CELL_ITALIC		0x0002
+#define TSM_CELL_UNDERLINE	0x0004
+#define TSM_CELL_INVERSE	0x0008
+#define TSM_CELL_BLINK		0x0010
+#define TSM_CELL_PROTECT	0x0020
+#define TSM_CELL_WIDE		0x0040	/* first cell of a wide character */
+#define TSM_CELL_TAIL		0x0080	/* trailing cell of a wide character */
+
+#define TSM_SCREEN_EXPORT_DIRTY	0x01
+
+/**
+ * Caller-provided arrays for tsm_screen_export().
+ *
+ * Each array holds one element per cell, rows are @p stride elements apart.
+ * Glyphs are symbol ids as stored in the screen; combined symbols can be
+ * resolved via tsm_screen_get_symbol(). Colors are 0xRRGGBB with inverse
+ * already applied. @ref rows is optional and receives 1 for each written row
+ * and 0 for each skipped one.
+ */
+struct tsm_cell_export {
+	tsm_symbol_t *glyphs;		/* symbol id of each cell */
+	uint32_t *fg;			/* effective foreground color */
+	uint32_t *bg;			/* effective background color */
+	uint16_t *flags;		/* TSM_CELL_* flags */
+	uint8_t *rows;			/* optional per-row dirty marks */
+	tsm_age_t age;			/* in: age of last export, out: new age */
+};
+
+typedef void (*tsm_screen_change_cb) (struct tsm_screen *con, void *data);
+
+typedef void (*tsm_screen_write_cb) (struct tsm_screen *con,
+				     const char *u8,
+				     size_t len,
+				     void *data);
+
+struct tsm_screen_snapshot;
+
+#define TSM_SCREEN_DUMP_ANSI	0
+#define TSM_SCREEN_DUMP_HTML	1
+
 int tsm_screen_new(struct tsm_screen **out, tsm_log_t log, void *log_data);
 void tsm_screen_ref(struct tsm_screen *con);
 void tsm_screen_unref(struct tsm_screen *con);
 
+bool tsm_screen_needs_redraw(struct tsm_screen *con, tsm_age_t age);
+void tsm_screen_set_change_cb(struct tsm_screen *con,
+			      tsm_screen_change_cb cb, void *data);
+
 unsigned int tsm_screen_get_width(struct tsm_screen *con);
 unsigned int tsm_screen_get_height(struct tsm_screen *con);
 int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
@@ -216,6 +300,8 @@ unsigned int tsm_screen_get_flags(struct tsm_screen *con);
 unsigned int tsm_screen_get_cursor_x(struct tsm_screen *con);
 unsigned int tsm_screen_get_cursor_y(struct tsm_screen *con);
 
+uint64_t tsm_screen_get_line_hash(struct tsm_screen *con, unsigned int y);
+
 void tsm_screen_set_tabstop(struct tsm_screen *con);
 void tsm_screen_reset_tabstop(struct tsm_screen *con);
 void tsm_screen_reset_all_tabstops(struct tsm_screen *con);
@@ -277,6 +363,283 @@ int tsm_screen_copy_all(struct tsm_screen *con, char **out);
 tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 			  void *data);
 
+/**
+ * @brief Draw only the cells that changed after a given age.
+ *
+ * This works like tsm_screen_draw() but @p draw_cb is only called for cells
+ * whose age is newer than @p age. Rows without any change are skipped as a
+ * whole, so drawing an idle screen costs one check per row.
+ *
+ * @param con The screen to draw.
+ * @param age The age returned by the last draw call, or 0 to draw everything.
+ * @param draw_cb Callback invoked for each changed cell.
+ * @param data User data passed to @p draw_cb.
+ *
+ * @return The new screen age to pass to the next call. If 0 is returned, the
+ * ages overflowed and the caller must redraw everything next time.
+ */
+tsm_age_t tsm_screen_draw_since(struct tsm_screen *con, tsm_age_t age,
+				tsm_screen_draw_cb draw_cb, void *data);
+
+/**
+ * @brief Draw the screen as runs of cells with identical attributes.
+ *
+ * Each row is split into maximal runs of cells whose effective attributes are
+ * equal and @p draw_cb is called once per run. This is meant for renderers
+ * that shape text and would otherwise have to reassemble runs themselves.
+ *
+ * @param con The screen to draw.
+ * @param draw_cb Callback invoked for each run.
+ * @param data User data passed to @p draw_cb.
+ *
+ * @return The new screen age, see tsm_screen_draw().
+ */
+tsm_age_t tsm_screen_draw_runs(struct tsm_screen *con,
+			       tsm_screen_draw_run_cb draw_cb, void *data);
+
+/**
+ * @brief Draw the screen from multiple threads.
+ *
+ * Splits the visible rows into @p nthreads bands of consecutive rows and draws
+ * them concurrently; the first band is drawn by the calling thread, the others
+ * by worker threads the screen keeps until it is destroyed. Bands have a
+ * minimum number of rows, so small screens may use fewer bands or be drawn by
+ * the calling thread alone. Cells of a band are passed in the same order as
+ * tsm_screen_draw() would, but bands are interleaved arbitrarily. @p draw_cb
+ * must therefore be thread-safe. The screen must not be modified, nor drawn
+ * from another thread, until this function returns.
+ *
+ * @param con The screen to draw.
+ * @param age Only cells changed after this age are drawn, see
+ *            tsm_screen_draw_since(). Pass 0 for a full redraw.
+ * @param nthreads Number of bands, 0 to use one per online CPU.
+ * @param draw_cb Thread-safe callback invoked for each cell.
+ * @param data User data passed to @p draw_cb.
+ *
+ * @return The new screen age, see tsm_screen_draw().
+ */
+tsm_age_t tsm_screen_draw_parallel(struct tsm_screen *con, tsm_age_t age,
+				   unsigned int nthreads,
+				   tsm_screen_draw_cb draw_cb, void *data);
+
+/**
+ * @brief Draw a rectangular region of the screen.
+ *
+ * Draws the @p w x @p h cells at @p x / @p y of the visible area, taking the
+ * scroll-back position into account. Positions passed to @p draw_cb are
+ * screen positions, not relative to the region. The region is clipped to the
+ * screen and only the cells inside of it are visited.
+ *
+ * Unlike the other draw functions, this does not mark the screen as drawn.
+ *
+ * @param con The screen to draw.
+ * @param x Column of the top-left cell.
+ * @param y Row of the top-left cell.
+ * @param w Width of the region.
+ * @param h Height of the region.
+ * @param draw_cb Callback invoked for each cell.
+ * @param data User data passed to @p draw_cb.
+ *
+ * @return The current screen age or 0 if the next full draw must redraw
+ *         everything.
+ */
+tsm_age_t tsm_screen_draw_region(struct tsm_screen *con, unsigned int x,
+				 unsigned int y, unsigned int w,
+				 unsigned int h, tsm_screen_draw_cb draw_cb,
+				 void *data);
+
+/**
+ * @brief Create an empty screen snapshot.
+ *
+ * A snapshot remembers the state of a remote terminal that mirrors a screen.
+ * An empty snapshot makes the next tsm_screen_diff() clear the remote screen
+ * and send everything.
+ *
+ * @param out Returns the new snapshot.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tsm_screen_snapshot_new(struct tsm_screen_snapshot **out);
+void tsm_screen_snapshot_free(struct tsm_screen_snapshot *snap);
+
+/**
+ * @brief Encode the changes of a screen as VT byte stream.
+ *
+ * Produces the escape sequences that transform a remote terminal showing
+ * @p snap into the current state of the active screen of @p con and updates
+ * @p snap to match. Only differing cells are sent, using cursor motion,
+ * erase, REP and SGR deltas. The remote terminal must have the same size as
+ * the screen; if the size changed, the remote screen is cleared and redrawn.
+ *
+ * A successful diff counts as a draw for the change callback, see
+ * tsm_screen_set_change_cb(), so a mirror can diff whenever it is called.
+ *
+ * @param con The screen to encode.
+ * @param snap Snapshot of the remote state, updated on success.
+ * @param write_cb Called with the encoded stream, possibly multiple times.
+ * @param data User data passed to @p write_cb.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tsm_screen_diff(struct tsm_screen *con, struct tsm_screen_snapshot *snap,
+		    tsm_screen_write_cb write_cb, void *data);
+
+/**
+ * @brief Dump the scroll-back buffer and the main screen.
+ *
+ * Streams every line of the scroll-back buffer followed by the main screen
+ * to @p write_cb in chunks of bounded size. The alternate screen is never
+ * dumped, even while it is active, as its content is not part of the
+ * scroll-back history. TSM_SCREEN_DUMP_ANSI produces
+ * UTF-8 text with SGR sequences, TSM_SCREEN_DUMP_HTML produces a <pre>
+ * element with styled <span> elements. Attributes are only emitted when they
+ * change and trailing blanks of each line are dropped.
+ *
+ * @param con The screen to dump.
+ * @param format One of the TSM_SCREEN_DUMP_* formats.
+ * @param write_cb Called with the output, possibly multiple times.
+ * @param data User data passed to @p write_cb.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tsm_screen_dump(struct tsm_screen *con, unsigned int format,
+		    tsm_screen_write_cb write_cb, void *data);
+
+/**
+ * Stream the current selection as UTF-8 text
+ *
+ * Same output as tsm_screen_selection_copy() but passed to @p write_cb in
+ * chunks of bounded size instead of allocating a buffer for the whole text.
+ * Lines are separated by "\n" and trailing blanks of each line are dropped.
+ *
+ * @param con The screen to copy from.
+ * @param write_cb Called with the text, possibly multiple times.
+ * @param data User data passed to @p write_cb.
+ *
+ * @return 0 on success, -ENOENT if there is no selection, negative error code
+ * on failure.
+ */
+int tsm_screen_selection_copy_cb(struct tsm_screen *con,
+				 tsm_screen_write_cb write_cb, void *data);
+
+/**
+ * Stream the scrollback buffer and screen as UTF-8 text
+ *
+ * Streaming counterpart of tsm_screen_copy_all(). Every line is terminated by
+ * "\n".
+ *
+ * @param con The screen to copy from.
+ * @param write_cb Called with the text, possibly multiple times.
+ * @param data User data passed to @p write_cb.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tsm_screen_copy_all_cb(struct tsm_screen *con,
+			   tsm_screen_write_cb write_cb, void *data);
+
+/**
+ * Set the extra word characters for word selection
+ *
+ * tsm_screen_selection_word() selects runs of letters, digits, CJK ideographs
+ * or punctuation. ASCII characters in @p chars additionally count as letters,
+ * so URLs and paths can be selected with a single double-click. The default
+ * is "-#%&+,./:=?@_~".
+ *
+ * @param con The screen to configure.
+ * @param chars ASCII characters to treat as word characters, NULL for the
+ * default.
+ *
+ * @return 0 on success, -EINVAL if @p chars contains non-ASCII characters.
+ */
+int tsm_screen_set_word_chars(struct tsm_screen *con, const char *chars);
+
+/**
+ * @brief Export the visible grid into flat arrays.
+ *
+ * Writes the visible rows, including the scroll-back position, into the
+ * arrays of @p buf in a single pass. With TSM_SCREEN_EXPORT_DIRTY set in
+ * @p flags, only rows that changed since @p buf->age are written and all
+ * other rows are left untouched. The new screen age is stored in @p buf->age.
+ *
+ * @param con The screen to export.
+ * @param buf Destination arrays.
+ * @param stride Number of elements per row, at least the screen width.
+ * @param flags TSM_SCREEN_EXPORT_* flags.
+ *
+ * @return Number of rows written or -EINVAL on invalid arguments.
+ */
+int tsm_screen_export(struct tsm_screen *con, struct tsm_cell_export *buf,
+		      unsigned int stride, unsigned int flags);
+
+/**
+ * @brief Resolve a symbol id into its code points.
+ *
+ * @param con The screen the symbol was read from.
+ * @param sym Symbol id; must stay valid while the result is used.
+ * @param len Returns the number of code points, may be NULL.
+ *
+ * @return Code points of @p sym or NULL on invalid arguments.
+ */
+const uint32_t *tsm_screen_get_symbol(struct tsm_screen *con,
+				      tsm_symbol_t *sym, size_t *len);
+
+/**
+ * Combined-symbol statistics of a screen
+ *
+ * Combined symbols are collected once no cell refers to them anymore and
+ * their ids are reused. Whenever that happens, @ref epoch changes and ids
+ * cached outside the screen, e.g. in a glyph cache, must be dropped.
+ */
+struct tsm_screen_symbol_stats {
+	size_t live;			/* combined symbols in use by cells */
+	size_t dead;			/* unused, freed by the next collection */
+	size_t free_ids;		/* ids of freed symbols awaiting reuse */
+	size_t bytes;			/* memory used by the symbol table */
+	unsigned long collections;	/* number of collections so far */
+	unsigned long epoch;		/* changes when ids are freed */
+};
+
+/**
+ * @brief Report combined-symbol usage.
+ *
+ * Walks the screen and its scroll-back buffer to tell live from dead symbols,
+ * so this costs about as much as a collection.
+ *
+ * @param con The screen to inspect.
+ * @param stats Filled with the statistics.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int tsm_screen_get_symbol_stats(struct tsm_screen *con,
+				struct tsm_screen_symbol_stats *stats);
+
+/**
+ * @brief Return the current symbol epoch.
+ *
+ * Same as the @ref tsm_screen_symbol_stats.epoch field, but cheap enough to
+ * be called before every frame. Whenever it differs from the value seen
+ * during the previous frame, combined-symbol ids may have been reused and
+ * caches keyed by the id passed to the draw callback must be flushed.
+ *
+ * @param con The screen to inspect.
+ *
+ * @return Current epoch, 0 if @p con is NULL.
+ */
+unsigned long tsm_screen_get_symbol_epoch(struct tsm_screen *con);
+
+/**
+ * @brief Free all unused combined symbols.
+ *
+ * Collections run automatically as new combined symbols are created and when
+ * the scroll-back buffer is shrunk or cleared. This forces one, e.g. after
+ * the application dropped its own history.
+ *
+ * @param con The screen to collect.
+ *
+ * @return Number of freed symbols or negative error code on failure.
+ */
+int tsm_screen_collect_symbols(struct tsm_screen *con);
+
 /** @} */
 
 /**
@@ -0,0 +1,422 @@
+/*
+ * libtsm - Screen Diffing
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Diffing
+ * A snapshot remembers what a remote terminal currently displays. Diffing a
+ * screen against a snapshot produces the VT byte stream that transforms the
+ * remote terminal into the current state of the active screen and updates the
+ * snapshot accordingly. Only cells that differ are sent, using cursor motion,
+ * erase (EL/ECH), repeat (REP) and SGR deltas to keep the stream short.
+ *
+ * The remote terminal is assumed to have the same size as the screen, no
+ * scroll region, origin mode off and auto-wrap on. Selection and scroll-back
+ * position are local concepts and are not mirrored.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-diff"
+
+#define DIFF_UNKNOWN ((unsigned int)-1)
+
+struct tsm_screen_snapshot {
+	unsigned int size_x;
+	unsigned int size_y;
+	struct cell *cells;
+
+	unsigned int cursor_x;
+	unsigned int cursor_y;
+	bool cursor_hidden;
+	struct tsm_screen_attr sgr;	/* current remote SGR state */
+	bool valid;			/* remote state is known */
+	unsigned long sym_epoch;	/* symbol table epoch of @cells */
+};
+
+/*
+ * Cells
+ * Cells are compared by what they display: empty cells and spaces look the
+ * same and the protect flag is invisible. Blank cells without underline or
+ * inverse can be produced by erase operations, which fill with the current
+ * background color.
+ */
+
+static bool cell_is_space(const struct cell *cell)
+{
+	return cell->ch == 0 || cell->ch == ' ';
+}
+
+static bool cell_equal(const struct cell *a, const struct cell *b)
+{
+	if (a->width != b->width || !screen_sgr_equal(&a->attr, &b->attr))
+		return false;
+	if (cell_is_space(a) && cell_is_space(b))
+		return true;
+	return a->ch == b->ch;
+}
+
+static bool cell_is_blank(const struct cell *cell)
+{
+	return cell_is_space(cell) && cell->width == 1 &&
+	       !cell->attr.underline && !cell->attr.inverse;
+}
+
+static bool cell_erase_equal(const struct cell *a, const struct cell *b)
+{
+	return cell_is_blank(a) && cell_is_blank(b) &&
+	       screen_sgr_bg_equal(&a->attr, &b->attr);
+}
+
+struct diff_state {
+	struct tsm_screen *con;
+	struct tsm_screen_snapshot *snap;
+	struct screen_out out;
+	unsigned int cx;		/* remote cursor or DIFF_UNKNOWN */
+	unsigned int cy;
+	struct cell empty;
+};
+
+static const struct cell *diff_cell(struct diff_state *st, struct line *line,
+				    unsigned int x)
+{
+	if (x < line->size)
+		return &line->cells[x];
+	return &st->empty;
+}
+
+static void diff_move(struct diff_state *st, struct line *line,
+		      const struct cell *old, unsigned int x, unsigned int y)
+{
+	struct screen_out *o = &st->out;
+	unsigned int i;
+	const struct cell *cell;
+	char buf[64];
+	int len;
+
+	if (st->cx == x && st->cy == y)
+		return;
+
+	if (st->cy == y && st->cx != DIFF_UNKNOWN && x > st->cx) {
+		/* rewriting up to three unchanged narrow cells in the
+		 * current SGR state is not longer than CUF */
+		if (x - st->cx <= 3) {
+			for (i = st->cx; i < x; ++i) {
+				cell = diff_cell(st, line, i);
+				if (cell->width != 1 ||
+				    cell->ch > 0x7f ||
+				    !cell_equal(cell, &old[i]) ||
+				    !screen_sgr_equal(&cell->attr, &st->snap->sgr))
+					break;
+			}
+
+			if (i == x) {
+				for (i = st->cx; i < x; ++i) {
+					cell = diff_cell(st, line, i);
+					buf[0] = cell->ch ? cell->ch : ' ';
+					screen_out_put(o, buf, 1);
+				}
+				st->cx = x;
+				return;
+			}
+		}
+
+		if (x - st->cx == 1) {
+			screen_out_str(o, "\e[C");
+		} else {
+			len = snprintf(buf, sizeof(buf), "\e[%uC", x - st->cx);
+			screen_out_put(o, buf, len);
+		}
+	} else if (st->cy == y && st->cx != DIFF_UNKNOWN && !x) {
+		screen_out_str(o, "\r");
+	} else if (!x) {
+		len = snprintf(buf, sizeof(buf), "\e[%uH", y + 1);
+		screen_out_put(o, buf, len);
+	} else {
+		len = snprintf(buf, sizeof(buf), "\e[%u;%uH", y + 1, x + 1);
+		screen_out_put(o, buf, len);
+	}
+
+	st->cx = x;
+	st->cy = y;
+}
+
+/* Returns true if the cells of @line from @x to the end of the row are blank
+ * and share the background color of @cell. */
+static bool diff_rest_blank(struct diff_state *st, struct line *line,
+			    const struct cell *cell, unsigned int x)
+{
+	unsigned int i;
+
+	if (!cell_is_blank(cell))
+		return false;
+
+	for (i = x + 1; i < st->con->size_x; ++i)
+		if (!cell_erase_equal(cell, diff_cell(st, line, i)))
+			return false;
+
+	return true;
+}
+
+static void diff_put_cell(struct diff_state *st, const struct cell *cell)
+{
+	struct screen_out *o = &st->out;
+	const uint32_t *ch;
+	size_t i, len;
+	char buf[4];
+	tsm_symbol_t sym = cell->ch;
+
+	if (cell_is_space(cell)) {
+		screen_out_put(o, " ", 1);
+		return;
+	}
+
+	ch = tsm_symbol_get(st->con->sym_table, &sym, &len);
+	for (i = 0; i < len; ++i)
+		screen_out_put(o, buf, tsm_ucs4_to_utf8(ch[i], buf));
+}
+
+static void diff_advance(struct diff_state *st, unsigned int width)
+{
+	st->cx += width;
+	/* the cursor is now in pending-wrap state, don't rely on it */
+	if (st->cx >= st->con->size_x)
+		st->cx = DIFF_UNKNOWN;
+}
+
+static void diff_line(struct diff_state *st, unsigned int y)
+{
+	struct tsm_screen *con = st->con;
+	struct tsm_screen_snapshot *snap = st->snap;
+	struct screen_out *o = &st->out;
+	struct line *line = con->lines[y];
+	struct cell *old = &snap->cells[y * snap->size_x];
+	const struct cell *cell;
+	unsigned int x, n, i;
+
+	x = 0;
+	while (x < con->size_x) {
+		cell = diff_cell(st, line, x);
+		if (cell_equal(cell, &old[x])) {
+			++x;
+			continue;
+		}
+
+		/* trailing cells of wide characters are written with the
+		 * character itself */
+		if (!cell->width) {
+			old[x++] = *cell;
+			continue;
+		}
+
+		if (diff_rest_blank(st, line, cell, x)) {
+			diff_move(st, line, old, x, y);
+			screen_sgr_set(o, &snap->sgr, &cell->attr);
+			screen_out_str(o, "\e[K");
+			for ( ; x < con->size_x; ++x)
+				old[x] = *diff_cell(st, line, x);
+			break;
+		}
+
+		/* count blank cells for ECH */
+		n = 1;
+		if (cell_is_blank(cell)) {
+			while (x + n < con->size_x &&
+			       cell_erase_equal(cell, diff_cell(st, line, x + n)))
+				++n;
+		}
+
+		if (n >= 4) {
+			diff_move(st, line, old, x, y);
+			screen_sgr_set(o, &snap->sgr, &cell->attr);
+			screen_out_str(o, "\e[");
+			screen_out_uint(o, n);
+			screen_out_str(o, "X");
+			for (i = 0; i < n; ++i, ++x)
+				old[x] = *diff_cell(st, line, x);
+			continue;
+		}
+
+		diff_move(st, line, old, x, y);
+		screen_sgr_set(o, &snap->sgr, &cell->attr);
+		diff_put_cell(st, cell);
+		old[x] = *cell;
+		for (i = 1; i < cell->width && x + i < con->size_x; ++i)
+			old[x + i] = *diff_cell(st, line, x + i);
+		x += cell->width;
+		diff_advance(st, cell->width);
+
+		/* repeat identical narrow characters with REP */
+		if (cell->width != 1 || cell->ch > TSM_UCS4_MAX ||
+		    st->cx == DIFF_UNKNOWN)
+			continue;
+
+		n = 0;
+		while (x + n < con->size_x &&
+		       cell_equal(cell, diff_cell(st, line, x + n)) &&
+		       !cell_equal(cell, &old[x + n]))
+			++n;
+
+		if (n >= 4) {
+			screen_out_str(o, "\e[");
+			screen_out_uint(o, n);
+			screen_out_str(o, "b");
+			for (i = 0; i < n; ++i, ++x)
+				old[x] = *diff_cell(st, line, x);
+			diff_advance(st, n);
+		}
+	}
+}
+
+SHL_EXPORT
+int tsm_screen_snapshot_new(struct tsm_screen_snapshot **out)
+{
+	struct tsm_screen_snapshot *snap;
+
+	if (!out)
+		return -EINVAL;
+
+	snap = malloc(sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+	memset(snap, 0, sizeof(*snap));
+	screen_sgr_reset(&snap->sgr);
+
+	*out = snap;
+	return 0;
+}
+
+SHL_EXPORT
+void tsm_screen_snapshot_free(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return;
+
+	free(snap->cells);
+	free(snap);
+}
+
+SHL_EXPORT
+int tsm_screen_diff(struct tsm_screen *con, struct tsm_screen_snapshot *snap,
+		    tsm_screen_write_cb write_cb, void *data)
+{
+	struct diff_state *st;
+	struct cell *cells;
+	unsigned int i, x, y;
+	bool hidden;
+
+	if (!con || !snap || !write_cb)
+		return -EINVAL;
+
+	st = malloc(sizeof(*st));
+	if (!st)
+		return -ENOMEM;
+	memset(st, 0, sizeof(*st));
+	st->con = con;
+	st->snap = snap;
+	st->out.con = con;
+	st->out.write_cb = write_cb;
+	st->out.data = data;
+	st->cx = snap->cursor_x;
+	st->cy = snap->cursor_y;
+	screen_cell_init(con, &st->empty);
+
+	/* start over on a cleared remote screen if we don't know its state */
+	if (!snap->valid || snap->size_x != con->size_x ||
+	    snap->size_y != con->size_y) {
+		cells = realloc(snap->cells, sizeof(*cells) * con->size_x *
+						    con->size_y);
+		if (!cells) {
+			free(st);
+			return -ENOMEM;
+		}
+
+		snap->cells = cells;
+		snap->size_x = con->size_x;
+		snap->size_y = con->size_y;
+		screen_sgr_reset(&snap->sgr);
+		for (i = 0; i < con->size_x * con->size_y; ++i) {
+			memset(&cells[i], 0, sizeof(cells[i]));
+			cells[i].width = 1;
+			cells[i].attr = snap->sgr;
+		}
+
+		screen_out_str(&st->out, "\e[0m\e[H\e[2J");
+		st->cx = 0;
+		st->cy = 0;
+		/* force the cursor visibility to be sent */
+		snap->cursor_hidden = !(con->flags & TSM_SCREEN_HIDE_CURSOR);
+		snap->valid = true;
+		snap->sym_epoch = tsm_symbol_table_get_epoch(con->sym_table);
+	}
+
+	/* combined symbols were collected and their ids may have been reused,
+	 * so the ids in the snapshot no longer tell what the remote shows.
+	 * TSM_UCS4_INVALID is never handed out as symbol id. */
+	if (snap->sym_epoch != tsm_symbol_table_get_epoch(con->sym_table)) {
+		for (i = 0; i < snap->size_x * snap->size_y; ++i) {
+			if (snap->cells[i].ch > TSM_UCS4_MAX)
+				snap->cells[i].ch = TSM_UCS4_INVALID;
+		}
+		snap->sym_epoch = tsm_symbol_table_get_epoch(con->sym_table);
+	}
+
+	for (y = 0; y < con->size_y; ++y)
+		diff_line(st, y);
+
+	x = con->cursor_x;
+	if (x >= con->size_x)
+		x = con->size_x - 1;
+	y = con->cursor_y;
+	if (y >= con->size_y)
+		y = con->size_y - 1;
+	if (st->cx != x || st->cy != y) {
+		screen_out_str(&st->out, "\e[");
+		screen_out_uint(&st->out, y + 1);
+		screen_out_str(&st->out, ";");
+		screen_out_uint(&st->out, x + 1);
+		screen_out_str(&st->out, "H");
+	}
+	snap->cursor_x = x;
+	snap->cursor_y = y;
+
+	hidden = con->flags & TSM_SCREEN_HIDE_CURSOR;
+	if (hidden != snap->cursor_hidden) {
+		screen_out_str(&st->out, hidden ? "\e[?25l" : "\e[?25h");
+		snap->cursor_hidden = hidden;
+	}
+
+	screen_out_flush(&st->out);
+	free(st);
+	screen_mark_drawn(con);
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * libtsm - Screen Dumps
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Dumps
+ * A dump streams the whole scroll-back buffer followed by the active screen
+ * into a write callback, either as ANSI text with SGR sequences or as HTML
+ * with one <span> per attribute change. Output goes through a fixed-size
+ * chunk buffer, so memory use does not depend on the size of the history.
+ * Trailing blank cells of each line are dropped.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-dump"
+
+struct dump_state {
+	struct tsm_screen *con;
+	struct screen_out out;
+	unsigned int format;
+	struct tsm_screen_attr cur;	/* attributes of the open span/SGR */
+	bool span;			/* HTML span is open */
+	struct tsm_screen_attr blank;	/* attributes of trimmed cells */
+	struct tsm_screen_attr reset;	/* attributes after SGR 0 */
+};
+
+static bool dump_cell_trimmable(struct dump_state *st, const struct cell *cell)
+{
+	return (cell->ch == 0 || cell->ch == ' ') && cell->width == 1 &&
+	       !cell->attr.underline && !cell->attr.inverse &&
+	       screen_sgr_bg_equal(&cell->attr, &st->blank);
+}
+
+static void dump_rgb(struct screen_out *o, uint8_t r, uint8_t g, uint8_t b)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[7];
+
+	buf[0] = '#';
+	buf[1] = hex[r >> 4];
+	buf[2] = hex[r & 0xf];
+	buf[3] = hex[g >> 4];
+	buf[4] = hex[g & 0xf];
+	buf[5] = hex[b >> 4];
+	buf[6] = hex[b & 0xf];
+	screen_out_put(o, buf, sizeof(buf));
+}
+
+static void dump_html_attr(struct dump_state *st,
+			   const struct tsm_screen_attr *attr)
+{
+	struct screen_out *o = &st->out;
+	bool fg, bg;
+
+	if (screen_sgr_equal(&st->cur, attr))
+		return;
+
+	if (st->span) {
+		screen_out_str(o, "</span>");
+		st->span = false;
+	}
+	memcpy(&st->cur, attr, sizeof(st->cur));
+
+	/* default colors are left to the style-sheet */
+	fg = attr->inverse || attr->fccode != TSM_COLOR_FOREGROUND;
+	bg = attr->inverse || attr->bccode != TSM_COLOR_BACKGROUND;
+	if (!fg && !bg && !attr->bold && !attr->italic && !attr->underline)
+		return;
+
+	screen_out_str(o, "<span style=\"");
+	if (fg) {
+		screen_out_str(o, "color:");
+		if (attr->inverse)
+			dump_rgb(o, attr->br, attr->bg, attr->bb);
+		else
+			dump_rgb(o, attr->fr, attr->fg, attr->fb);
+		screen_out_str(o, ";");
+	}
+	if (bg) {
+		screen_out_str(o, "background-color:");
+		if (attr->inverse)
+			dump_rgb(o, attr->fr, attr->fg, attr->fb);
+		else
+			dump_rgb(o, attr->br, attr->bg, attr->bb);
+		screen_out_str(o, ";");
+	}
+	if (attr->bold)
+		screen_out_str(o, "font-weight:bold;");
+	if (attr->italic)
+		screen_out_str(o, "font-style:italic;");
+	if (attr->underline)
+		screen_out_str(o, "text-decoration:underline;");
+	screen_out_str(o, "\">");
+	st->span = true;
+}
+
+static void dump_html_ucs4(struct screen_out *o, uint32_t ucs4)
+{
+	char buf[4];
+
+	switch (ucs4) {
+	case '<':
+		screen_out_str(o, "&lt;");
+		break;
+	case '>':
+		screen_out_str(o, "&gt;");
+		break;
+	case '&':
+		screen_out_str(o, "&amp;");
+		break;
+	default:
+		screen_out_put(o, buf, tsm_ucs4_to_utf8(ucs4, buf));
+		break;
+	}
+}
+
+/* code points collected before they are encoded in one go */
+#define DUMP_BATCH 256
+
+static void dump_flush(struct dump_state *st, const uint32_t *ucs4, size_t *num)
+{
+	char buf[DUMP_BATCH * 4];
+
+	screen_out_put(&st->out, buf, tsm_ucs4_to_utf8_bulk(ucs4, *num, buf));
+	*num = 0;
+}
+
+static void dump_line(struct dump_state *st, struct line *line)
+{
+	struct screen_out *o = &st->out;
+	const struct cell *cell;
+	const uint32_t *ch;
+	uint32_t batch[DUMP_BATCH];
+	tsm_symbol_t sym;
+	unsigned int i, len;
+	size_t j, n, num = 0;
+
+	len = line->size < st->con->size_x ? line->size : st->con->size_x;
+	while (len && dump_cell_trimmable(st, &line->cells[len - 1]))
+		--len;
+
+	for (i = 0; i < len; ++i) {
+		cell = &line->cells[i];
+		if (!cell->width)
+			continue;
+
+		sym = cell->ch ? cell->ch : ' ';
+		ch = tsm_symbol_get(st->con->sym_table, &sym, &n);
+
+		if (st->format == TSM_SCREEN_DUMP_HTML) {
+			dump_html_attr(st, &cell->attr);
+			for (j = 0; j < n; ++j)
+				dump_html_ucs4(o, ch[j]);
+			continue;
+		}
+
+		/* text is batched until the attributes change */
+		if (num + n > DUMP_BATCH ||
+		    (num && !screen_sgr_equal(&st->cur, &cell->attr)))
+			dump_flush(st, batch, &num);
+		screen_sgr_set(o, &st->cur, &cell->attr);
+		for (j = 0; j < n; ++j)
+			batch[num++] = ch[j];
+	}
+
+	if (num)
+		dump_flush(st, batch, &num);
+
+	if (st->format == TSM_SCREEN_DUMP_HTML) {
+		screen_out_str(o, "\n");
+	} else {
+		/* don't let the background bleed into the next line */
+		if (!screen_sgr_bg_equal(&st->cur, &st->reset))
+			screen_sgr_set(o, &st->cur, &st->reset);
+		screen_out_str(o, "\r\n");
+	}
+}
+
+SHL_EXPORT
+int tsm_screen_dump(struct tsm_screen *con, unsigned int format,
+		    tsm_screen_write_cb write_cb, void *data)
+{
+	struct dump_state *st;
+	struct line *line;
+	unsigned int i;
+
+	if (!con || !write_cb)
+		return -EINVAL;
+	if (format != TSM_SCREEN_DUMP_ANSI && format != TSM_SCREEN_DUMP_HTML)
+		return -EINVAL;
+
+	st = malloc(sizeof(*st));
+	if (!st)
+		return -ENOMEM;
+	memset(st, 0, sizeof(*st));
+	st->con = con;
+	st->format = format;
+	st->out.con = con;
+	st->out.write_cb = write_cb;
+	st->out.data = data;
+	screen_sgr_reset(&st->cur);
+	screen_sgr_reset(&st->reset);
+	memcpy(&st->blank, &con->def_attr, sizeof(st->blank));
+
+	if (format == TSM_SCREEN_DUMP_HTML)
+		screen_out_str(&st->out, "<pre class=\"tsm\">");
+	else
+		screen_out_str(&st->out, "\e[0m");
+
+	/*
+	 * The scroll-back buffer only ever holds lines of the main screen, so
+	 * always continue with the main screen, even if the alternate screen
+	 * is active. The output stays one coherent transcript.
+	 */
+	for (line = con->sb_first; line; line = line->next)
+		dump_line(st, line);
+	for (i = 0; i < con->size_y; ++i)
+		dump_line(st, con->main_lines[i]);
+
+	if (format == TSM_SCREEN_DUMP_HTML) {
+		if (st->span)
+			screen_out_str(&st->out, "</span>");
+		screen_out_str(&st->out, "</pre>\n");
+	} else {
+		screen_sgr_set(&st->out, &st->cur, &st->reset);
+	}
+
+	screen_out_flush(&st->out);
+	free(st);
+	return 0;
+}
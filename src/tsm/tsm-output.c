@@ -0,0 +1,197 @@
+/*
+ * libtsm - Output Helpers
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Output Helpers
+ * Encoders that produce byte streams share a small chunk buffer which is
+ * flushed into a write callback whenever it fills up, so their memory use
+ * does not depend on the size of the output. The SGR encoder tracks the
+ * attributes the receiving terminal currently has and only emits changes.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+
+void screen_out_flush(struct screen_out *o)
+{
+	if (o->len) {
+		o->write_cb(o->con, o->buf, o->len, o->data);
+		o->len = 0;
+	}
+}
+
+void screen_out_put(struct screen_out *o, const char *u8, size_t len)
+{
+	size_t n;
+
+	while (len) {
+		if (o->len == sizeof(o->buf))
+			screen_out_flush(o);
+
+		n = sizeof(o->buf) - o->len;
+		if (n > len)
+			n = len;
+		memcpy(&o->buf[o->len], u8, n);
+		o->len += n;
+		u8 += n;
+		len -= n;
+	}
+}
+
+void screen_out_str(struct screen_out *o, const char *str)
+{
+	screen_out_put(o, str, strlen(str));
+}
+
+void screen_out_uint(struct screen_out *o, unsigned int num)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%u", num);
+	screen_out_put(o, buf, len);
+}
+
+/*
+ * SGR
+ * The remote SGR state is tracked in the snapshot. Attributes are only turned
+ * on incrementally; if any attribute has to be turned off, the state is reset
+ * with SGR 0 first, which is shorter than the individual "off" codes.
+ */
+
+void screen_sgr_reset(struct tsm_screen_attr *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->fccode = TSM_COLOR_FOREGROUND;
+	attr->bccode = TSM_COLOR_BACKGROUND;
+}
+
+static bool color_equal(int8_t ca, uint8_t ra, uint8_t ga, uint8_t ba,
+			int8_t cb, uint8_t rb, uint8_t gb, uint8_t bb)
+{
+	if (ca >= 0 || cb >= 0)
+		return ca == cb;
+	return ra == rb && ga == gb && ba == bb;
+}
+
+bool screen_sgr_fg_equal(const struct tsm_screen_attr *a,
+			 const struct tsm_screen_attr *b)
+{
+	return color_equal(a->fccode, a->fr, a->fg, a->fb,
+			   b->fccode, b->fr, b->fg, b->fb);
+}
+
+bool screen_sgr_bg_equal(const struct tsm_screen_attr *a,
+			 const struct tsm_screen_attr *b)
+{
+	return color_equal(a->bccode, a->br, a->bg, a->bb,
+			   b->bccode, b->br, b->bg, b->bb);
+}
+
+/* Like screen_attr_equal() but only compares what SGR can express. */
+bool screen_sgr_equal(const struct tsm_screen_attr *a,
+		      const struct tsm_screen_attr *b)
+{
+	return screen_sgr_fg_equal(a, b) && screen_sgr_bg_equal(a, b) &&
+	       a->bold == b->bold &&
+	       a->italic == b->italic &&
+	       a->underline == b->underline &&
+	       a->inverse == b->inverse &&
+	       a->blink == b->blink;
+}
+
+static void sgr_param(struct screen_out *o, bool *first, const char *param)
+{
+	if (*first) {
+		screen_out_str(o, "\e[");
+		*first = false;
+	} else {
+		screen_out_str(o, ";");
+	}
+	screen_out_str(o, param);
+}
+
+static void sgr_color(struct screen_out *o, bool *first, int8_t code,
+		      uint8_t r, uint8_t g, uint8_t b, bool bg)
+{
+	char buf[32];
+
+	if (code < 0)
+		snprintf(buf, sizeof(buf), "%u;2;%u;%u;%u", bg ? 48 : 38,
+			 r, g, b);
+	else if (code < 8)
+		snprintf(buf, sizeof(buf), "%u", (bg ? 40 : 30) + code);
+	else if (code < 16)
+		snprintf(buf, sizeof(buf), "%u", (bg ? 100 : 90) + code - 8);
+	else
+		snprintf(buf, sizeof(buf), "%u", bg ? 49 : 39);
+
+	sgr_param(o, first, buf);
+}
+
+void screen_sgr_set(struct screen_out *o, struct tsm_screen_attr *cur,
+		    const struct tsm_screen_attr *attr)
+{
+	bool first = true;
+
+	if (screen_sgr_equal(cur, attr))
+		return;
+
+	if ((cur->bold && !attr->bold) ||
+	    (cur->italic && !attr->italic) ||
+	    (cur->underline && !attr->underline) ||
+	    (cur->inverse && !attr->inverse) ||
+	    (cur->blink && !attr->blink)) {
+		sgr_param(o, &first, "0");
+		screen_sgr_reset(cur);
+	}
+
+	if (attr->bold && !cur->bold)
+		sgr_param(o, &first, "1");
+	if (attr->italic && !cur->italic)
+		sgr_param(o, &first, "3");
+	if (attr->underline && !cur->underline)
+		sgr_param(o, &first, "4");
+	if (attr->blink && !cur->blink)
+		sgr_param(o, &first, "5");
+	if (attr->inverse && !cur->inverse)
+		sgr_param(o, &first, "7");
+	if (!screen_sgr_fg_equal(cur, attr))
+		sgr_color(o, &first, attr->fccode, attr->fr, attr->fg,
+			  attr->fb, false);
+	if (!screen_sgr_bg_equal(cur, attr))
+		sgr_color(o, &first, attr->bccode, attr->br, attr->bg,
+			  attr->bb, true);
+
+	if (!first)
+		screen_out_str(o, "m");
+
+	memcpy(cur, attr, sizeof(*cur));
+}
@@ -32,169 +32,835 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "libtsm.h"
 #include "libtsm-int.h"
 #include "shl-llog.h"
 
 #define LLOG_SUBSYSTEM "tsm-render"
 
-SHL_EXPORT
-tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
-			  void *data)
+/*
+ * Draw Iterator
+ * All draw functions walk the visible rows the same way: first the lines of
+ * the scroll-back buffer starting at sb_pos, then the active lines. The
+ * selection is normalized once per draw into absolute row positions, so each
+ * row gets a column span [sel_from, sel_to] of selected cells and cells can be
+ * visited in any order.
+ * Rows are positioned by their line id, see screen_line_id().
+ */
+
+struct draw_iter {
+	struct tsm_screen *con;
+	struct line *iter;		/* next sb-line or NULL */
+	unsigned int k;			/* next index into con->lines */
+	unsigned int cur_x;		/* cursor x-pos clamped to screen */
+	unsigned int cur_y;		/* cursor y-pos clamped to screen */
+	bool sel;			/* selection is active */
+	uint64_t sel_lo;		/* position of first selected row */
+	uint64_t sel_hi;		/* position of last selected row */
+	unsigned int sel_lo_x;		/* first selected column of sel_lo */
+	unsigned int sel_hi_x;		/* last selected column of sel_hi */
+	unsigned int sel_from;		/* first selected column of row */
+	unsigned int sel_to;		/* last selected column of row */
+	struct cell empty;		/* used for cells beyond line->size */
+};
+
+static void draw_iter_init(struct draw_iter *it, struct tsm_screen *con)
+{
+	uint64_t start, end;
+
+	memset(it, 0, sizeof(*it));
+	it->con = con;
+	it->iter = con->sb_pos;
+	screen_cell_init(con, &it->empty);
+
+	it->cur_x = con->cursor_x;
+	if (con->cursor_x >= con->size_x)
+		it->cur_x = con->size_x - 1;
+	it->cur_y = con->cursor_y;
+	if (con->cursor_y >= con->size_y)
+		it->cur_y = con->size_y - 1;
+
+	if (!con->sel_active)
+		return;
+
+	start = con->sel_start.id;
+	end = con->sel_end.id;
+
+	it->sel = true;
+	if (start < end ||
+	    (start == end && con->sel_start.x <= con->sel_end.x)) {
+		it->sel_lo = start;
+		it->sel_lo_x = con->sel_start.x;
+		it->sel_hi = end;
+		it->sel_hi_x = con->sel_end.x;
+	} else {
+		it->sel_lo = end;
+		it->sel_lo_x = con->sel_end.x;
+		it->sel_hi = start;
+		it->sel_hi_x = con->sel_start.x;
+	}
+
+	/* both ends dropped from the scroll-back buffer is no selection */
+	if (it->sel_hi < screen_first_id(con))
+		it->sel = false;
+}
+
+static struct line *draw_iter_next(struct draw_iter *it)
+{
+	struct tsm_screen *con = it->con;
+	struct line *line;
+	uint64_t pos;
+
+	if (it->iter) {
+		line = it->iter;
+		it->iter = it->iter->next;
+		pos = line->sb_id;
+	} else {
+		line = con->lines[it->k];
+		pos = screen_line_id(con, it->k);
+		it->k++;
+	}
+
+	it->sel_from = 1;
+	it->sel_to = 0;
+	if (it->sel && pos >= it->sel_lo && pos <= it->sel_hi) {
+		it->sel_from = pos == it->sel_lo ? it->sel_lo_x : 0;
+		it->sel_to = pos == it->sel_hi ? it->sel_hi_x : con->size_x;
+	}
+
+	return line;
+}
+
+/* Skip @num rows without computing their selection spans. */
+static void draw_iter_seek(struct draw_iter *it, unsigned int num)
+{
+	while (num && it->iter) {
+		it->iter = it->iter->next;
+		--num;
+	}
+
+	it->k += num;
+}
+
+static inline bool draw_iter_in_sel(struct draw_iter *it, unsigned int x)
 {
-	unsigned int cur_x, cur_y;
-	unsigned int i, j, k;
-	struct line *iter, *line = NULL;
-	struct cell *cell, empty;
+	return x >= it->sel_from && x <= it->sel_to;
+}
+
+static tsm_age_t draw_iter_line_age(struct draw_iter *it, struct line *line)
+{
+	tsm_age_t age;
+
+	age = line->cell_age;
+	if (line->age > age)
+		age = line->age;
+	if (it->con->age > age)
+		age = it->con->age;
+
+	return age;
+}
+
+/* Return cell @x of @line and store its effective attributes in @attr. */
+static struct cell *draw_iter_cell(struct draw_iter *it, struct line *line,
+				   unsigned int x,
+				   struct tsm_screen_attr *attr,
+				   tsm_age_t *age)
+{
+	struct tsm_screen *con = it->con;
+	struct cell *cell;
+
+	if (x < line->size)
+		cell = &line->cells[x];
+	else
+		cell = &it->empty;
+
+	memcpy(attr, &cell->attr, sizeof(*attr));
+
+	if (it->k == it->cur_y + 1 && x == it->cur_x &&
+	    !(con->flags & TSM_SCREEN_HIDE_CURSOR))
+		attr->inverse = !attr->inverse;
+
+	/* TODO: do some more sophisticated inverse here. When
+	 * INVERSE mode is set, we should instead just select
+	 * inverse colors instead of switching background and
+	 * foreground */
+	if (con->flags & TSM_SCREEN_INVERSE)
+		attr->inverse = !attr->inverse;
+
+	if (draw_iter_in_sel(it, x))
+		attr->inverse = !attr->inverse;
+
+	if (con->age_reset) {
+		*age = 0;
+	} else {
+		*age = cell->age;
+		if (line->age > *age)
+			*age = line->age;
+		if (con->age > *age)
+			*age = con->age;
+	}
+
+	return cell;
+}
+
+/* Encode attributes into the id to avoid caching problems */
+static uint64_t cell_id(const struct cell *cell,
+			const struct tsm_screen_attr *attr)
+{
+	uint64_t id = cell->ch;
+
+	if (attr->bold)
+		id |= 1ULL << TSM_UCS4_MAX_BITS;
+	if (attr->italic)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 1);
+	if (attr->underline)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 2);
+	if (attr->inverse)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 3);
+	if (attr->blink)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 4);
+
+	return id;
+}
+
+static tsm_age_t draw_finish(struct tsm_screen *con)
+{
+	screen_mark_drawn(con);
+
+	if (con->age_reset) {
+		con->age_reset = 0;
+		return 0;
+	} else {
+		return con->age_cnt;
+	}
+}
+
+/*
+ * Draw all cells of @num rows and the @w columns starting at @x, starting at
+ * the row @it points to, that changed after @since. If @since is 0, every
+ * cell is drawn. Rows whose line-age, youngest cell-age and screen-age are
+ * all not newer than @since are skipped without looking at their cells.
+ */
+static void draw_rows(struct draw_iter *it, unsigned int first,
+		      unsigned int num, unsigned int x, unsigned int w,
+		      tsm_age_t since, tsm_screen_draw_cb draw_cb, void *data)
+{
+	struct tsm_screen *con = it->con;
+	unsigned int i, j;
+	struct line *line;
+	struct cell *cell;
 	struct tsm_screen_attr attr;
 	int ret, warned = 0;
 	const uint32_t *ch;
-	uint64_t id;
 	size_t len;
-	bool in_sel = false, sel_start = false, sel_end = false;
-	bool was_sel = false;
 	tsm_age_t age;
 
+	/* push each character into rendering pipeline */
+
+	for (i = first; i < first + num; ++i) {
+		line = draw_iter_next(it);
+
+		if (since && draw_iter_line_age(it, line) <= since)
+			continue;
+
+		for (j = x; j < x + w; ++j) {
+			cell = draw_iter_cell(it, line, j, &attr, &age);
+			if (since && age <= since)
+				continue;
+
+			ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
+			if (cell->ch == 0 || (cell->ch == ' ' && !attr.underline))
+				len = 0;
+			ret = draw_cb(con, cell_id(cell, &attr), ch, len,
+				      cell->width, j, i, &attr, age, data);
+			if (ret && warned++ < 3) {
+				llog_debug(con,
+					   "cannot draw glyph at %ux%u via text-renderer",
+					   j, i);
+				if (warned == 3)
+					llog_debug(con,
+						   "suppressing further warnings during this rendering round");
+			}
+		}
+	}
+}
+
+static tsm_age_t screen_draw(struct tsm_screen *con, tsm_age_t since,
+			     tsm_screen_draw_cb draw_cb, void *data)
+{
+	struct draw_iter it;
+
+	if (con->age_reset)
+		since = 0;
+
+	draw_iter_init(&it, con);
+	draw_rows(&it, 0, con->size_y, 0, con->size_x, since, draw_cb, data);
+
+	return draw_finish(con);
+}
+
+SHL_EXPORT
+tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
+			  void *data)
+{
 	if (!con || !draw_cb)
 		return 0;
 
-	screen_cell_init(con, &empty);
+	return screen_draw(con, 0, draw_cb, data);
+}
 
-	cur_x = con->cursor_x;
-	if (con->cursor_x >= con->size_x)
-		cur_x = con->size_x - 1;
-	cur_y = con->cursor_y;
-	if (con->cursor_y >= con->size_y)
-		cur_y = con->size_y - 1;
+SHL_EXPORT
+tsm_age_t tsm_screen_draw_since(struct tsm_screen *con, tsm_age_t age,
+				tsm_screen_draw_cb draw_cb, void *data)
+{
+	if (!con || !draw_cb)
+		return 0;
 
-	/* push each character into rendering pipeline */
+	return screen_draw(con, age, draw_cb, data);
+}
+
+/*
+ * Draw only the rectangle of @w x @h cells at @x/@y of the visible area,
+ * including the scroll-back position. The rectangle is clipped to the screen.
+ * As the remaining cells are not drawn, the screen is not marked as drawn and
+ * the change callback is not re-armed.
+ */
+SHL_EXPORT
+tsm_age_t tsm_screen_draw_region(struct tsm_screen *con, unsigned int x,
+				 unsigned int y, unsigned int w,
+				 unsigned int h, tsm_screen_draw_cb draw_cb,
+				 void *data)
+{
+	struct draw_iter it;
 
-	iter = con->sb_pos;
-	k = 0;
+	if (!con || !draw_cb)
+		return 0;
 
-	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP)
-			in_sel = !in_sel;
-		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP)
-			in_sel = !in_sel;
+	if (x < con->size_x && y < con->size_y) {
+		if (w > con->size_x - x)
+			w = con->size_x - x;
+		if (h > con->size_y - y)
+			h = con->size_y - y;
 
-		if (con->sel_start.line &&
-		    (!iter || con->sel_start.line->sb_id < iter->sb_id))
-			in_sel = !in_sel;
-		if (con->sel_end.line &&
-		    (!iter || con->sel_end.line->sb_id < iter->sb_id))
-			in_sel = !in_sel;
+		draw_iter_init(&it, con);
+		draw_iter_seek(&it, y);
+		draw_rows(&it, y, h, x, w, 0, draw_cb, data);
 	}
 
-	for (i = 0; i < con->size_y; ++i) {
-		if (iter) {
-			line = iter;
-			iter = iter->next;
-		} else {
-			line = con->lines[k];
-			k++;
+	return con->age_reset ? 0 : con->age_cnt;
+}
+
+/*
+ * Parallel Rendering
+ * The visible rows are split into bands of consecutive rows. As the draw
+ * iterator carries no per-cell state, a copy of it positioned at the first
+ * row of a band is all a band needs. The first band is drawn by the caller,
+ * all others by a pool of worker threads that the screen keeps until it is
+ * destroyed, so a frame costs two condition-variable round trips instead of
+ * spawning threads. Worker i draws band i + 1 of every frame. The screen is
+ * only read while drawing, so the callback is the only part that must be
+ * thread-safe.
+ * Bands of only a few rows are not worth the hand-off, so each band gets at
+ * least DRAW_BAND_MIN_ROWS rows and small screens are drawn serially.
+ */
+
+#define DRAW_BAND_MIN_ROWS 8
+
+struct draw_band {
+	struct draw_iter it;
+	unsigned int first;
+	unsigned int num;
+	tsm_age_t since;
+	tsm_screen_draw_cb draw_cb;
+	void *data;
+};
+
+struct draw_worker {
+	struct screen_draw_pool *pool;
+	unsigned int idx;
+	unsigned long frame;		/* last frame seen */
+	pthread_t thread;
+};
+
+struct screen_draw_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	/* new frame or exit */
+	pthread_cond_t done_cond;	/* all worker bands drawn */
+
+	struct draw_worker **workers;
+	unsigned int num;
+
+	struct draw_band *bands;
+	unsigned int bands_size;
+	unsigned int active;		/* workers with a band this frame */
+	unsigned int pending;		/* worker bands not drawn yet */
+	unsigned long frame;
+	bool exit;
+};
+
+static void draw_band_run(struct draw_band *band)
+{
+	draw_rows(&band->it, band->first, band->num, 0, band->it.con->size_x,
+		  band->since, band->draw_cb, band->data);
+}
+
+static void *draw_worker_fn(void *arg)
+{
+	struct draw_worker *w = arg;
+	struct screen_draw_pool *pool = w->pool;
+	struct draw_band *band;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->exit && pool->frame == w->frame)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->exit)
+			break;
+
+		w->frame = pool->frame;
+		if (w->idx >= pool->active)
+			continue;
+
+		band = &pool->bands[w->idx + 1];
+		pthread_mutex_unlock(&pool->lock);
+		draw_band_run(band);
+		pthread_mutex_lock(&pool->lock);
+
+		if (!--pool->pending)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static int draw_pool_new(struct screen_draw_pool **out)
+{
+	struct screen_draw_pool *pool;
+	int r;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return -ENOMEM;
+
+	r = pthread_mutex_init(&pool->lock, NULL);
+	if (r)
+		goto err_free;
+	r = pthread_cond_init(&pool->work_cond, NULL);
+	if (r)
+		goto err_lock;
+	r = pthread_cond_init(&pool->done_cond, NULL);
+	if (r)
+		goto err_work;
+
+	*out = pool;
+	return 0;
+
+err_work:
+	pthread_cond_destroy(&pool->work_cond);
+err_lock:
+	pthread_mutex_destroy(&pool->lock);
+err_free:
+	free(pool);
+	return -r;
+}
+
+void screen_draw_pool_free(struct screen_draw_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->exit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->num; ++i) {
+		pthread_join(pool->workers[i]->thread, NULL);
+		free(pool->workers[i]);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool->bands);
+	free(pool);
+}
+
+/*
+ * Make sure the pool has room for @nbands bands and up to @nbands - 1
+ * workers. Workers that cannot be spawned are not an error, their bands are
+ * drawn by the caller. Must not be called while a frame is in flight.
+ */
+static int draw_pool_grow(struct tsm_screen *con, struct screen_draw_pool *pool,
+			  unsigned int nbands)
+{
+	struct draw_worker **workers, *w;
+	struct draw_band *bands;
+	int r;
+
+	if (nbands > pool->bands_size) {
+		workers = realloc(pool->workers,
+				  (nbands - 1) * sizeof(*workers));
+		if (!workers)
+			return -ENOMEM;
+		pool->workers = workers;
+
+		bands = realloc(pool->bands, nbands * sizeof(*bands));
+		if (!bands)
+			return -ENOMEM;
+		pool->bands = bands;
+		pool->bands_size = nbands;
+	}
+
+	while (pool->num < nbands - 1) {
+		w = calloc(1, sizeof(*w));
+		if (!w)
+			return -ENOMEM;
+
+		w->pool = pool;
+		w->idx = pool->num;
+		w->frame = pool->frame;
+
+		r = pthread_create(&w->thread, NULL, draw_worker_fn, w);
+		if (r) {
+			llog_debug(con, "cannot spawn render thread (%d)", r);
+			free(w);
+			break;
 		}
 
-		if (con->sel_active) {
-			if (con->sel_start.line == line ||
-			    (!con->sel_start.line &&
-			     con->sel_start.y == k - 1))
-				sel_start = true;
-			else
-				sel_start = false;
-			if (con->sel_end.line == line ||
-			    (!con->sel_end.line &&
-			     con->sel_end.y == k - 1))
-				sel_end = true;
-			else
-				sel_end = false;
-
-			was_sel = false;
+		pool->workers[pool->num++] = w;
+	}
+
+	return 0;
+}
+
+SHL_EXPORT
+tsm_age_t tsm_screen_draw_parallel(struct tsm_screen *con, tsm_age_t age,
+				   unsigned int nthreads,
+				   tsm_screen_draw_cb draw_cb, void *data)
+{
+	struct screen_draw_pool *pool;
+	struct draw_band *bands;
+	struct draw_iter it;
+	unsigned int i, j, row, active;
+	long cpus;
+	int r;
+
+	if (!con || !draw_cb)
+		return 0;
+
+	if (con->age_reset)
+		age = 0;
+
+	if (!nthreads) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = cpus > 0 ? cpus : 1;
+	}
+	if (nthreads > con->size_y / DRAW_BAND_MIN_ROWS)
+		nthreads = con->size_y / DRAW_BAND_MIN_ROWS;
+	if (nthreads <= 1)
+		return screen_draw(con, age, draw_cb, data);
+
+	if (!con->draw_pool) {
+		r = draw_pool_new(&con->draw_pool);
+		if (r) {
+			llog_warning(con, "cannot create render pool (%d)", r);
+			return screen_draw(con, age, draw_cb, data);
 		}
+	}
+	pool = con->draw_pool;
+
+	r = draw_pool_grow(con, pool, nthreads);
+	if (r) {
+		llog_warning(con, "cannot grow render pool (%d)", r);
+		return screen_draw(con, age, draw_cb, data);
+	}
+	bands = pool->bands;
+
+	/* position one iterator copy at the first row of each band */
+	draw_iter_init(&it, con);
+	for (i = 0, row = 0; i < nthreads; ++i) {
+		memcpy(&bands[i].it, &it, sizeof(it));
+		bands[i].first = row;
+		bands[i].num = (con->size_y * (i + 1)) / nthreads - row;
+		bands[i].since = age;
+		bands[i].draw_cb = draw_cb;
+		bands[i].data = data;
+
+		for (j = 0; j < bands[i].num; ++j)
+			draw_iter_next(&it);
+		row += bands[i].num;
+	}
+
+	active = nthreads - 1;
+	if (active > pool->num)
+		active = pool->num;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->active = active;
+	pool->pending = active;
+	++pool->frame;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	draw_band_run(&bands[0]);
+
+	/* draw bands without a worker ourselves */
+	for (i = active + 1; i < nthreads; ++i)
+		draw_band_run(&bands[i]);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return draw_finish(con);
+}
+
+/*
+ * Run Rendering
+ * Instead of one callback per cell, each row is split into maximal runs of
+ * cells with identical effective attributes. The code points of all cells of
+ * a run are passed as one array, which is what text-shaping engines want.
+ * Empty cells are passed as U+0020 and the trailing cells of wide characters
+ * contribute no code points.
+ */
+
+SHL_EXPORT
+tsm_age_t tsm_screen_draw_runs(struct tsm_screen *con,
+			       tsm_screen_draw_run_cb draw_cb, void *data)
+{
+	struct draw_iter it;
+	unsigned int i, j;
+	struct line *line;
+	struct cell *cell;
+	struct tsm_screen_attr attr;
+	struct tsm_screen_run run;
+	uint32_t *buf;
+	uint8_t *widths, *lens;
+	const uint32_t *ch;
+	size_t len;
+	tsm_age_t age;
+	int ret, warned = 0;
+
+	if (!con || !draw_cb)
+		return 0;
+
+	buf = malloc(con->size_x * (sizeof(*buf) * TSM_UCS4_MAXLEN + 2));
+	if (!buf) {
+		llog_warning(con, "cannot allocate run buffer");
+		return 0;
+	}
+	widths = (uint8_t*)&buf[con->size_x * TSM_UCS4_MAXLEN];
+	lens = &widths[con->size_x];
+
+	draw_iter_init(&it, con);
+
+	for (i = 0; i < con->size_y; ++i) {
+		line = draw_iter_next(&it);
+
+		memset(&run, 0, sizeof(run));
+		run.ch = buf;
+		run.widths = widths;
+		run.lens = lens;
+		run.posy = i;
 
 		for (j = 0; j < con->size_x; ++j) {
-			if (j < line->size)
-				cell = &line->cells[j];
-			else
-				cell = &empty;
-
-			memcpy(&attr, &cell->attr, sizeof(attr));
-
-			if (con->sel_active) {
-				if (sel_start &&
-				    j == con->sel_start.x) {
-					was_sel = in_sel;
-					in_sel = !in_sel;
-				}
-				if (sel_end &&
-				    j == con->sel_end.x) {
-					was_sel = in_sel;
-					in_sel = !in_sel;
-				}
-			}
+			cell = draw_iter_cell(&it, line, j, &attr, &age);
 
-			if (k == cur_y + 1 && j == cur_x &&
-			    !(con->flags & TSM_SCREEN_HIDE_CURSOR))
-				attr.inverse = !attr.inverse;
+			if (run.cells && !screen_attr_equal(&attr, &run.attr)) {
+				ret = draw_cb(con, &run, data);
+				if (ret && warned++ < 3)
+					llog_debug(con,
+						   "cannot draw run at %ux%u via text-renderer",
+						   run.posx, i);
 
-			/* TODO: do some more sophisticated inverse here. When
-			 * INVERSE mode is set, we should instead just select
-			 * inverse colors instead of switching background and
-			 * foreground */
-			if (con->flags & TSM_SCREEN_INVERSE)
-				attr.inverse = !attr.inverse;
+				run.len = 0;
+				run.cells = 0;
+			}
 
-			if (in_sel || was_sel) {
-				was_sel = false;
-				attr.inverse = !attr.inverse;
+			if (!run.cells) {
+				memcpy(&run.attr, &attr, sizeof(attr));
+				run.posx = j;
+				run.age = age;
 			}
 
-			if (con->age_reset) {
-				age = 0;
+			if (!cell->width) {
+				len = 0;
+			} else if (!cell->ch) {
+				len = 1;
+				buf[run.len] = ' ';
 			} else {
-				age = cell->age;
-				if (line->age > age)
-					age = line->age;
-				if (con->age > age)
-					age = con->age;
+				ch = tsm_symbol_get(con->sym_table, &cell->ch,
+						    &len);
+				memcpy(&buf[run.len], ch, len * sizeof(*ch));
 			}
 
-			/* Encode attributes into the id to avoid caching problems */
-			id = cell->ch;
-			if (attr.bold)
-				id |= 1ULL << TSM_UCS4_MAX_BITS;
-			if (attr.italic)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 1);
-			if (attr.underline)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 2);
-			if (attr.inverse)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 3);
-			if (attr.blink)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 4);
+			widths[run.cells] = cell->width;
+			lens[run.cells] = len;
+			run.len += len;
+			++run.cells;
+			if (age > run.age)
+				run.age = age;
+		}
 
-			ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
-			if (cell->ch == 0 || (cell->ch == ' ' && !attr.underline))
-				len = 0;
-			ret = draw_cb(con, id, ch, len, cell->width,
-				      j, i, &attr, age, data);
-			if (ret && warned++ < 3) {
+		if (run.cells) {
+			ret = draw_cb(con, &run, data);
+			if (ret && warned++ < 3)
 				llog_debug(con,
-					   "cannot draw glyph at %ux%u via text-renderer",
-					   j, i);
-				if (warned == 3)
-					llog_debug(con,
-						   "suppressing further warnings during this rendering round");
-			}
+					   "cannot draw run at %ux%u via text-renderer",
+					   run.posx, i);
 		}
 	}
 
-	if (con->age_reset) {
-		con->age_reset = 0;
-		return 0;
+	free(buf);
+	return draw_finish(con);
+}
+
+/*
+ * Grid Export
+ * Instead of calling back into the renderer, the visible grid is written into
+ * caller-provided flat arrays, one element per cell and @stride elements per
+ * row. Colors are exported as 0xRRGGBB with inverse already resolved, so the
+ * arrays can be uploaded as textures or instance buffers as they are.
+ */
+
+static inline uint32_t export_rgb(uint8_t r, uint8_t g, uint8_t b)
+{
+	return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+}
+
+/* Export @cell with its inverse attribute toggled by @flip. */
+static inline void export_cell(const struct cell *cell, bool flip,
+			       tsm_symbol_t *glyph, uint32_t *fg, uint32_t *bg,
+			       uint16_t *flags)
+{
+	const struct tsm_screen_attr *attr = &cell->attr;
+	uint16_t f = 0;
+
+	*glyph = cell->ch;
+	if (attr->inverse != flip) {
+		*fg = export_rgb(attr->br, attr->bg, attr->bb);
+		*bg = export_rgb(attr->fr, attr->fg, attr->fb);
+		f |= TSM_CELL_INVERSE;
 	} else {
-		return con->age_cnt;
+		*fg = export_rgb(attr->fr, attr->fg, attr->fb);
+		*bg = export_rgb(attr->br, attr->bg, attr->bb);
 	}
+
+	if (attr->bold)
+		f |= TSM_CELL_BOLD;
+	if (attr->italic)
+		f |= TSM_CELL_ITALIC;
+	if (attr->underline)
+		f |= TSM_CELL_UNDERLINE;
+	if (attr->blink)
+		f |= TSM_CELL_BLINK;
+	if (attr->protect)
+		f |= TSM_CELL_PROTECT;
+	if (cell->width > 1)
+		f |= TSM_CELL_WIDE;
+	else if (!cell->width)
+		f |= TSM_CELL_TAIL;
+
+	*flags = f;
+}
+
+SHL_EXPORT
+int tsm_screen_export(struct tsm_screen *con, struct tsm_cell_export *buf,
+		      unsigned int stride, unsigned int flags)
+{
+	struct draw_iter it;
+	unsigned int i, j;
+	struct line *line;
+	struct cell *cell;
+	tsm_symbol_t *glyphs;
+	uint32_t *fg, *bg;
+	uint16_t *fl;
+	unsigned int len, from, to;
+	tsm_age_t since;
+	bool inv;
+	int num = 0;
+
+	if (!con || !buf || !buf->glyphs || !buf->fg || !buf->bg ||
+	    !buf->flags || stride < con->size_x)
+		return -EINVAL;
+
+	since = 0;
+	if ((flags & TSM_SCREEN_EXPORT_DIRTY) && !con->age_reset)
+		since = buf->age;
+
+	inv = !!(con->flags & TSM_SCREEN_INVERSE);
+	draw_iter_init(&it, con);
+
+	for (i = 0; i < con->size_y; ++i) {
+		line = draw_iter_next(&it);
+
+		if (since && draw_iter_line_age(&it, line) <= since) {
+			if (buf->rows)
+				buf->rows[i] = 0;
+			continue;
+		}
+
+		glyphs = &buf->glyphs[(size_t)i * stride];
+		fg = &buf->fg[(size_t)i * stride];
+		bg = &buf->bg[(size_t)i * stride];
+		fl = &buf->flags[(size_t)i * stride];
+
+		/* The selection only toggles the inverse attribute of the cells
+		 * in [sel_from, sel_to], so the row is exported in up to three
+		 * uniform stretches and the cursor is fixed up afterwards. */
+		len = line->size < con->size_x ? line->size : con->size_x;
+		from = it.sel_from < len ? it.sel_from : len;
+		to = it.sel_to < len ? it.sel_to + 1 : len;
+		if (from > to)
+			from = to = len;
+
+		for (j = 0; j < from; ++j)
+			export_cell(&line->cells[j], inv, &glyphs[j], &fg[j],
+				    &bg[j], &fl[j]);
+		for ( ; j < to; ++j)
+			export_cell(&line->cells[j], !inv, &glyphs[j], &fg[j],
+				    &bg[j], &fl[j]);
+		for ( ; j < len; ++j)
+			export_cell(&line->cells[j], inv, &glyphs[j], &fg[j],
+				    &bg[j], &fl[j]);
+		for ( ; j < con->size_x; ++j)
+			export_cell(&it.empty, inv != draw_iter_in_sel(&it, j),
+				    &glyphs[j], &fg[j], &bg[j], &fl[j]);
+
+		if (it.k == it.cur_y + 1 &&
+		    !(con->flags & TSM_SCREEN_HIDE_CURSOR)) {
+			j = it.cur_x;
+			cell = j < line->size ? &line->cells[j] : &it.empty;
+			export_cell(cell, inv == draw_iter_in_sel(&it, j),
+				    &glyphs[j], &fg[j], &bg[j], &fl[j]);
+		}
+
+		if (buf->rows)
+			buf->rows[i] = 1;
+		++num;
+	}
+
+	buf->age = draw_finish(con);
+	return num;
+}
+
+SHL_EXPORT
+const uint32_t *tsm_screen_get_symbol(struct tsm_screen *con,
+				      tsm_symbol_t *sym, size_t *len)
+{
+	if (!con || !sym)
+		return NULL;
+
+	return tsm_symbol_get(con->sym_table, sym, len);
 }
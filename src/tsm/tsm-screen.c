@@ -67,9 +67,10 @@
 
 #define LLOG_SUBSYSTEM "tsm-screen"
 
-static struct cell *get_cursor_cell(struct tsm_screen *con)
+static void age_cursor_cell(struct tsm_screen *con)
 {
 	unsigned int cur_x, cur_y;
+	struct line *line;
 
 	cur_x = con->cursor_x;
 	if (cur_x >= con->size_x)
@@ -79,13 +80,13 @@ static struct cell *get_cursor_cell(struct tsm_screen *con)
 	if (cur_y >= con->size_y)
 		cur_y = con->size_y - 1;
 
-	return &con->lines[cur_y]->cells[cur_x];
+	line = con->lines[cur_y];
+	line->cells[cur_x].age = con->age_cnt;
+	line->cell_age = con->age_cnt;
 }
 
 static void move_cursor(struct tsm_screen *con, unsigned int x, unsigned int y)
 {
-	struct cell *c;
-
 	/* if cursor is hidden, just move it */
 	if (con->flags & TSM_SCREEN_HIDE_CURSOR) {
 		con->cursor_x = x;
@@ -100,14 +101,12 @@ static void move_cursor(struct tsm_screen *con, unsigned int x, unsigned int y)
 	if (con->cursor_x == x && con->cursor_y == y)
 		return;
 
-	c = get_cursor_cell(con);
-	c->age = con->age_cnt;
+	age_cursor_cell(con);
 
 	con->cursor_x = x;
 	con->cursor_y = y;
 
-	c = get_cursor_cell(con);
-	c->age = con->age_cnt;
+	age_cursor_cell(con);
 }
 
 void screen_cell_init(struct tsm_screen *con, struct cell *cell)
@@ -133,7 +132,10 @@ static int line_new(struct tsm_screen *con, struct line **out,
 	line->next = NULL;
 	line->prev = NULL;
 	line->size = width;
+	line->wrapped = 0;
 	line->age = con->age_cnt;
+	line->cell_age = con->age_cnt;
+	line->hash_age = 0;
 
 	line->cells = malloc(sizeof(struct cell) * width);
 	if (!line->cells) {
@@ -168,6 +170,7 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 			return -ENOMEM;
 
 		line->cells = tmp;
+		line->cell_age = con->age_cnt;
 
 		while (line->size < width) {
 			screen_cell_init(con, &line->cells[line->size]);
@@ -178,6 +181,71 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 	return 0;
 }
 
+/*
+ * Symbol Collection
+ * Combined symbols live in the symbol table until a collection finds no cell
+ * referring to them anymore. Collections run when new symbols are created
+ * and the table doubled since the last one, and whenever a bulk of lines is
+ * dropped from the scroll-back buffer. Every line of both screens and of the
+ * scroll-back buffer is marked, including rows beyond the current height
+ * which a resize can bring back.
+ */
+
+static int screen_sym_mark(struct tsm_screen *con)
+{
+	struct line *iter;
+	unsigned int i, j;
+	int ret;
+
+	ret = tsm_symbol_table_mark_begin(con->sym_table);
+	if (ret)
+		return ret;
+
+	for (iter = con->sb_first; iter; iter = iter->next) {
+		for (j = 0; j < iter->size; ++j)
+			tsm_symbol_table_mark(con->sym_table,
+					      iter->cells[j].ch);
+	}
+
+	for (i = 0; i < con->line_num; ++i) {
+		for (j = 0; j < con->main_lines[i]->size; ++j)
+			tsm_symbol_table_mark(con->sym_table,
+					      con->main_lines[i]->cells[j].ch);
+		for (j = 0; j < con->alt_lines[i]->size; ++j)
+			tsm_symbol_table_mark(con->sym_table,
+					      con->alt_lines[i]->cells[j].ch);
+	}
+
+	return 0;
+}
+
+static int screen_sym_gc(struct tsm_screen *con)
+{
+	int ret;
+
+	ret = screen_sym_mark(con);
+	if (ret)
+		return ret;
+
+	return tsm_symbol_table_sweep(con->sym_table);
+}
+
+static void screen_free_sb(struct tsm_screen *con)
+{
+	struct line *iter, *tmp;
+
+	for (iter = con->sb_first; iter; ) {
+		tmp = iter;
+		iter = iter->next;
+		line_free(tmp);
+	}
+
+	con->sb_first = NULL;
+	con->sb_last = NULL;
+	con->sb_count = 0;
+	con->sb_pos = NULL;
+}
+
 /* This links the given line into the scrollback-buffer */
 static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 {
@@ -187,16 +255,7 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	con->age = con->age_cnt;
 
 	if (con->sb_max == 0) {
-		if (con->sel_active) {
-			if (con->sel_start.line == line) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == line) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
+		++con->sb_last_id;
 		line_free(line);
 		return;
 	}
@@ -231,16 +290,6 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 			}
 		}
 
-		if (con->sel_active) {
-			if (con->sel_start.line == tmp) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == tmp) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
 		line_free(tmp);
 	}
 
@@ -255,10 +304,98 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	++con->sb_count;
 }
 
+/*
+ * Selection anchors on the screen are line ids, see screen_line_id(). When
+ * rows move inside a region @top..@bottom, anchors on those rows must move
+ * with them while anchors outside the region stay on their row.
+ * screen_sel_row() records the row of an anchor before the move, -1 for
+ * anchors in the scroll-back buffer, and screen_sel_move() fixes up the ids
+ * afterwards.
+ */
+static int screen_sel_row(struct tsm_screen *con,
+			  const struct selection_pos *pos)
+{
+	if (pos->id <= con->sb_last_id ||
+	    pos->id - con->sb_last_id > con->size_y)
+		return -1;
+
+	return pos->id - con->sb_last_id - 1;
+}
+
+/* Anchors on screen rows have no meaning on the other screen, so switching
+ * between the main and the alternate screen drops such selections. */
+static void screen_sel_switch(struct tsm_screen *con)
+{
+	if (screen_sel_row(con, &con->sel_start) >= 0 ||
+	    screen_sel_row(con, &con->sel_end) >= 0)
+		con->sel_active = false;
+}
+
+/* Returns true if the anchor was on a row that left the region and was
+ * clamped to the edge of the region. */
+static bool screen_sel_anchor_move(struct tsm_screen *con,
+				   struct selection_pos *pos, int y,
+				   unsigned int top, unsigned int bottom,
+				   int num, uint64_t sb_id)
+{
+	if (y < 0)
+		return false;
+
+	if (y < (int)top || y > (int)bottom) {
+		pos->id = screen_line_id(con, y);
+		return false;
+	}
+
+	if (y + num < (int)top) {
+		if (sb_id) {
+			pos->id = sb_id + y - top;
+			return false;
+		}
+
+		pos->id = screen_line_id(con, top);
+		pos->x = 0;
+		return true;
+	}
+
+	if (y + num > (int)bottom) {
+		pos->id = screen_line_id(con, bottom);
+		pos->x = con->size_x - 1;
+		return true;
+	}
+
+	pos->id = screen_line_id(con, y + num);
+	return false;
+}
+
+/*
+ * Rows @top..@bottom moved by @num rows, upwards if negative. Anchors on rows
+ * that left the region at the top follow their line into the scroll-back
+ * buffer if @sb_id is non-zero, which is the id the first of these lines got.
+ * Otherwise, the line is gone and the anchor is clamped to the region. If
+ * both anchors are gone, so is the selection.
+ */
+static void screen_sel_move(struct tsm_screen *con, int start_y, int end_y,
+			    unsigned int top, unsigned int bottom, int num,
+			    uint64_t sb_id)
+{
+	bool start_lost, end_lost;
+
+	if (!con->sel_active)
+		return;
+
+	start_lost = screen_sel_anchor_move(con, &con->sel_start, start_y,
+					    top, bottom, num, sb_id);
+	end_lost = screen_sel_anchor_move(con, &con->sel_end, end_y,
+					  top, bottom, num, sb_id);
+	if (start_lost && end_lost)
+		con->sel_active = false;
+}
+
 static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 {
 	unsigned int i, j, max, pos;
-	int ret;
+	int ret, start_y, end_y;
+	uint64_t sb_id = 0;
 
 	if (!num)
 		return;
@@ -282,6 +419,15 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 	}
 	struct line **cache = malloc(sizeof(struct line *) * num);
 
+	start_y = screen_sel_row(con, &con->sel_start);
+	end_y = screen_sel_row(con, &con->sel_end);
+
+	/* lines of the main screen take the next ids even if they cannot be
+	 * kept, lines of the alternate screen never reach the scroll-back
+	 * buffer and leave the ids alone */
+	if (!(con->flags & TSM_SCREEN_ALTERNATE))
+		sb_id = con->sb_last_id + 1;
+
 	for (i = 0; i < num; ++i) {
 		pos = con->margin_top + i;
 		if (!(con->flags & TSM_SCREEN_ALTERNATE))
@@ -295,6 +441,10 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 			cache[i] = con->lines[pos];
 			for (j = 0; j < con->size_x; ++j)
 				screen_cell_init(con, &cache[i]->cells[j]);
+			cache[i]->wrapped = 0;
+			cache[i]->cell_age = con->age_cnt;
+			if (sb_id)
+				++con->sb_last_id;
 		}
 	}
 
@@ -307,26 +457,8 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 	memcpy(&con->lines[con->margin_top + (max - num)],
 	       cache, num * sizeof(struct line*));
 
-	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y >= 0) {
-			con->sel_start.y -= num;
-			if (con->sel_start.y < 0) {
-				con->sel_start.line = con->sb_last;
-				while (con->sel_start.line && ++con->sel_start.y < 0)
-					con->sel_start.line = con->sel_start.line->prev;
-				con->sel_start.y = SELECTION_TOP;
-			}
-		}
-		if (!con->sel_end.line && con->sel_end.y >= 0) {
-			con->sel_end.y -= num;
-			if (con->sel_end.y < 0) {
-				con->sel_end.line = con->sb_last;
-				while (con->sel_end.line && ++con->sel_end.y < 0)
-					con->sel_end.line = con->sel_end.line->prev;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
-	}
+	screen_sel_move(con, start_y, end_y, con->margin_top,
+			con->margin_bottom, -(int)num, sb_id);
 
 	free(cache);
 }
@@ -334,6 +466,7 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 {
 	unsigned int i, j, max;
+	int start_y, end_y;
 
 	if (!num)
 		return;
@@ -353,10 +486,15 @@ static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	}
 	struct line **cache = malloc(sizeof(struct line *) * num);
 
+	start_y = screen_sel_row(con, &con->sel_start);
+	end_y = screen_sel_row(con, &con->sel_end);
+
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->margin_bottom - i];
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j]);
+		cache[i]->wrapped = 0;
+		cache[i]->cell_age = con->age_cnt;
 	}
 
 	if (num < max) {
@@ -368,12 +506,8 @@ static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	memcpy(&con->lines[con->margin_top],
 	       cache, num * sizeof(struct line*));
 
-	if (con->sel_active) {
-		if (!con->sel_start.line && con->sel_start.y >= 0)
-			con->sel_start.y += num;
-		if (!con->sel_end.line && con->sel_end.y >= 0)
-			con->sel_end.y += num;
-	}
+	screen_sel_move(con, start_y, end_y, con->margin_top,
+			con->margin_bottom, num, 0);
 
 	free(cache);
 }
@@ -402,6 +536,7 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 			sizeof(struct cell) * (con->size_x - len - x));
 	}
 
+	line->cell_age = con->age_cnt;
 	line->cells[x].age = con->age_cnt;
 	line->cells[x].ch = ch;
 	line->cells[x].width = len;
@@ -439,6 +574,9 @@ static void screen_erase_region(struct tsm_screen *con,
 			to = x_to;
 		else
 			to = con->size_x - 1;
+		if (to == con->size_x - 1)
+			line->wrapped = 0;
+		line->cell_age = con->age_cnt;
 		for ( ; x_from <= to; ++x_from) {
 			if (protect && line->cells[x_from].attr.protect)
 				continue;
@@ -485,6 +623,7 @@ int tsm_screen_new(struct tsm_screen **out, tsm_log_t log, void *log_data)
 	con->def_attr.fr = 255;
 	con->def_attr.fg = 255;
 	con->def_attr.fb = 255;
+	tsm_screen_set_word_chars(con, NULL);
 
 	ret = tsm_symbol_table_new(&con->sym_table);
 	if (ret)
@@ -539,7 +678,8 @@ void tsm_screen_unref(struct tsm_screen *con)
 	free(con->alt_lines);
 	free(con->tab_ruler);
 	tsm_symbol_table_unref(con->sym_table);
-	tsm_screen_clear_sb(con);
+	screen_free_sb(con);
+	screen_draw_pool_free(con->draw_pool);
 	free(con);
 }
 
@@ -567,6 +707,37 @@ unsigned int tsm_screen_get_opts(struct tsm_screen *scr)
 	return scr->opts;
 }
 
+/*
+ * Returns true if anything changed after @age, which is the value returned by
+ * the last draw. An @age of 0 always requires a redraw.
+ */
+SHL_EXPORT
+bool tsm_screen_needs_redraw(struct tsm_screen *con, tsm_age_t age)
+{
+	if (!con)
+		return false;
+
+	return !age || con->age_reset || con->age_cnt > age;
+}
+
+/*
+ * The change callback is edge-triggered: it is called by the first change
+ * after a draw and not again until the screen has been drawn. A successful
+ * tsm_screen_diff() counts as a draw. It is called from inside of the
+ * modifying function and must not modify the screen.
+ */
+SHL_EXPORT
+void tsm_screen_set_change_cb(struct tsm_screen *con,
+			      tsm_screen_change_cb cb, void *data)
+{
+	if (!con)
+		return;
+
+	con->change_cb = cb;
+	con->change_data = data;
+	con->dirty = 0;
+}
+
 SHL_EXPORT
 unsigned int tsm_screen_get_width(struct tsm_screen *con)
 {
@@ -695,6 +866,7 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 
 		for ( ; i < con->main_lines[j]->size; ++i)
 			screen_cell_init(con, &con->main_lines[j]->cells[i]);
+		con->main_lines[j]->cell_age = con->age_cnt;
 
 		/* alt-lines never go into SB, only clear visible cells */
 		i = 0;
@@ -703,6 +875,7 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 
 		for ( ; i < x; ++i)
 			screen_cell_init(con, &con->alt_lines[j]->cells[i]);
+		con->alt_lines[j]->cell_age = con->age_cnt;
 	}
 
 	if (!(con->flags & TSM_SCREEN_ALTERNATE)) {
@@ -753,6 +926,9 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 				con->sb_last->next = NULL;
 			else
 				con->sb_first = NULL;
+
+			/* keep the line ids of the screen rows */
+			con->sb_last_id -= num;
 		}
 	}
 
@@ -852,28 +1028,17 @@ void tsm_screen_set_max_sb(struct tsm_screen *con,
 		if (con->sb_pos == line)
 			con->sb_pos = con->sb_first;
 
-		if (con->sel_active) {
-			if (con->sel_start.line == line) {
-				con->sel_start.line = NULL;
-				con->sel_start.y = SELECTION_TOP;
-			}
-			if (con->sel_end.line == line) {
-				con->sel_end.line = NULL;
-				con->sel_end.y = SELECTION_TOP;
-			}
-		}
 		line_free(line);
 	}
 
 	con->sb_max = max;
+	screen_sym_gc(con);
 }
 
 /* clear scrollback buffer */
 SHL_EXPORT
 void tsm_screen_clear_sb(struct tsm_screen *con)
 {
-	struct line *iter, *tmp;
-
 	if (!con)
 		return;
 
@@ -881,27 +1046,8 @@ void tsm_screen_clear_sb(struct tsm_screen *con)
 	/* TODO: more sophisticated ageing */
 	con->age = con->age_cnt;
 
-	for (iter = con->sb_first; iter; ) {
-		tmp = iter;
-		iter = iter->next;
-		line_free(tmp);
-	}
-
-	con->sb_first = NULL;
-	con->sb_last = NULL;
-	con->sb_count = 0;
-	con->sb_pos = NULL;
-
-	if (con->sel_active) {
-		if (con->sel_start.line) {
-			con->sel_start.line = NULL;
-			con->sel_start.y = SELECTION_TOP;
-		}
-		if (con->sel_end.line) {
-			con->sel_end.line = NULL;
-			con->sel_end.y = SELECTION_TOP;
-		}
-	}
+	screen_free_sb(con);
+	screen_sym_gc(con);
 }
 
 SHL_EXPORT
@@ -1043,7 +1189,6 @@ SHL_EXPORT
 void tsm_screen_set_flags(struct tsm_screen *con, unsigned int flags)
 {
 	unsigned int old;
-	struct cell *c;
 
 	if (!con || !flags)
 		return;
@@ -1056,12 +1201,12 @@ void tsm_screen_set_flags(struct tsm_screen *con, unsigned int flags)
 	if (!(old & TSM_SCREEN_ALTERNATE) && (flags & TSM_SCREEN_ALTERNATE)) {
 		con->age = con->age_cnt;
 		con->lines = con->alt_lines;
+		screen_sel_switch(con);
 	}
 
 	if (!(old & TSM_SCREEN_HIDE_CURSOR) &&
 	    (flags & TSM_SCREEN_HIDE_CURSOR)) {
-		c = get_cursor_cell(con);
-		c->age = con->age_cnt;
+		age_cursor_cell(con);
 	}
 
 	if (!(old & TSM_SCREEN_INVERSE) && (flags & TSM_SCREEN_INVERSE))
@@ -1072,7 +1217,6 @@ SHL_EXPORT
 void tsm_screen_reset_flags(struct tsm_screen *con, unsigned int flags)
 {
 	unsigned int old;
-	struct cell *c;
 
 	if (!con || !flags)
 		return;
@@ -1085,12 +1229,12 @@ void tsm_screen_reset_flags(struct tsm_screen *con, unsigned int flags)
 	if ((old & TSM_SCREEN_ALTERNATE) && (flags & TSM_SCREEN_ALTERNATE)) {
 		con->age = con->age_cnt;
 		con->lines = con->main_lines;
+		screen_sel_switch(con);
 	}
 
 	if ((old & TSM_SCREEN_HIDE_CURSOR) &&
 	    (flags & TSM_SCREEN_HIDE_CURSOR)) {
-		c = get_cursor_cell(con);
-		c->age = con->age_cnt;
+		age_cursor_cell(con);
 	}
 
 	if ((old & TSM_SCREEN_INVERSE) && (flags & TSM_SCREEN_INVERSE))
@@ -1106,6 +1250,88 @@ unsigned int tsm_screen_get_flags(struct tsm_screen *con)
 	return con->flags;
 }
 
+/*
+ * Line Hashes
+ * Each line caches a 64bit FNV-1a hash over the code points, widths and
+ * attributes of its cells. Every mutator already bumps line->cell_age, so the
+ * cache is valid as long as cell_age did not change since it was computed.
+ * The age-epoch catches ages that repeat after an age-overflow. Combined
+ * symbols are hashed by their code points, so hashes of different screens
+ * can be compared. Empty cells hash like spaces.
+ */
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+	return (h ^ v) * 0x100000001b3ULL;
+}
+
+static uint64_t line_hash(struct tsm_screen *con, struct line *line)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const struct tsm_screen_attr *a;
+	const struct cell *cell;
+	struct cell empty;
+	const uint32_t *ch;
+	tsm_symbol_t sym;
+	unsigned int i;
+	size_t j, len;
+
+	/* hash what draw_rows() shows: size_x cells, blank past line->size */
+	screen_cell_init(con, &empty);
+
+	for (i = 0; i < con->size_x; ++i) {
+		cell = i < line->size ? &line->cells[i] : &empty;
+		sym = cell->ch ? cell->ch : ' ';
+		ch = tsm_symbol_get(con->sym_table, &sym, &len);
+		for (j = 0; j < len; ++j)
+			h = hash_mix(h, ch[j]);
+
+		a = &cell->attr;
+		h = hash_mix(h, (uint64_t)(uint8_t)a->fccode |
+				(uint64_t)(uint8_t)a->bccode << 8 |
+				(uint64_t)a->fr << 16 |
+				(uint64_t)a->fg << 24 |
+				(uint64_t)a->fb << 32 |
+				(uint64_t)a->br << 40 |
+				(uint64_t)a->bg << 48 |
+				(uint64_t)a->bb << 56);
+		h = hash_mix(h, a->bold | a->italic << 1 | a->underline << 2 |
+				a->inverse << 3 | a->protect << 4 |
+				a->blink << 5 |
+				cell->width << 8);
+	}
+
+	return h;
+}
+
+SHL_EXPORT
+uint64_t tsm_screen_get_line_hash(struct tsm_screen *con, unsigned int y)
+{
+	struct line *line;
+
+	if (!con || y >= con->size_y)
+		return 0;
+
+	line = con->sb_pos;
+	while (line && y) {
+		line = line->next;
+		--y;
+	}
+	if (!line)
+		line = con->lines[y];
+
+	if (!line->hash_age || line->hash_age != line->cell_age ||
+	    line->hash_epoch != con->age_epoch ||
+	    line->hash_width != con->size_x) {
+		line->hash = line_hash(con, line);
+		line->hash_age = line->cell_age;
+		line->hash_epoch = con->age_epoch;
+		line->hash_width = con->size_x;
+	}
+
+	return line->hash;
+}
+
 SHL_EXPORT
 unsigned int tsm_screen_get_cursor_x(struct tsm_screen *con)
 {
@@ -1176,10 +1402,12 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 		last = con->size_y - 1;
 
 	if (con->cursor_x >= con->size_x) {
-		if (con->flags & TSM_SCREEN_AUTO_WRAP)
+		if (con->flags & TSM_SCREEN_AUTO_WRAP) {
+			con->lines[con->cursor_y]->wrapped = 1;
 			move_cursor(con, 0, con->cursor_y + 1);
-		else
+		} else {
 			move_cursor(con, con->size_x - 1, con->cursor_y);
+		}
 	}
 
 	if (con->cursor_y > last) {
@@ -1191,6 +1419,47 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 	move_cursor(con, con->cursor_x + len, con->cursor_y);
 }
 
+/*
+ * Append @ucs4 to the symbol of the cell left of the cursor, which is the
+ * last written cell as long as the cursor did not move since. This is used
+ * for code points that continue a grapheme cluster without a width of their
+ * own, so the cell keeps its width.
+ */
+void screen_append(struct tsm_screen *con, uint32_t ucs4)
+{
+	struct line *line;
+	struct cell *cell;
+	tsm_symbol_t sym;
+	unsigned int x;
+
+	if (!con->cursor_x || con->cursor_y >= con->size_y)
+		return;
+
+	x = con->cursor_x - 1;
+	if (x >= con->size_x)
+		x = con->size_x - 1;
+
+	line = con->lines[con->cursor_y];
+	while (x > 0 && !line->cells[x].width)
+		--x;
+
+	cell = &line->cells[x];
+	if (!cell->ch)
+		return;
+
+	if (tsm_symbol_table_gc_due(con->sym_table))
+		screen_sym_gc(con);
+
+	sym = tsm_symbol_append(con->sym_table, cell->ch, ucs4);
+	if (sym == cell->ch)
+		return;
+
+	screen_inc_age(con);
+	cell->ch = sym;
+	cell->age = con->age_cnt;
+	line->cell_age = con->age_cnt;
+}
+
 SHL_EXPORT
 void tsm_screen_newline(struct tsm_screen *con)
 {
@@ -1429,6 +1698,7 @@ SHL_EXPORT
 void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 {
 	unsigned int i, j, max;
+	int start_y, end_y;
 
 	if (!con || !num)
 		return;
@@ -1447,10 +1717,14 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 
 	struct line **cache = malloc(sizeof(struct line *) * num);
 
+	start_y = screen_sel_row(con, &con->sel_start);
+	end_y = screen_sel_row(con, &con->sel_end);
+
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->margin_bottom - i];
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j]);
+		cache[i]->cell_age = con->age_cnt;
 	}
 
 	if (num < max) {
@@ -1462,6 +1736,9 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 		       cache, num * sizeof(struct line*));
 	}
 
+	screen_sel_move(con, start_y, end_y, con->cursor_y,
+			con->margin_bottom, num, 0);
+
 	con->cursor_x = 0;
 	free(cache);
 }
@@ -1470,6 +1747,7 @@ SHL_EXPORT
 void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 {
 	unsigned int i, j, max;
+	int start_y, end_y;
 
 	if (!con || !num)
 		return;
@@ -1488,10 +1766,14 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 
 	struct line **cache = malloc(sizeof(struct line *) * num);
 
+	start_y = screen_sel_row(con, &con->sel_start);
+	end_y = screen_sel_row(con, &con->sel_end);
+
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->cursor_y + i];
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j]);
+		cache[i]->cell_age = con->age_cnt;
 	}
 
 	if (num < max) {
@@ -1503,6 +1785,9 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 		       cache, num * sizeof(struct line*));
 	}
 
+	screen_sel_move(con, start_y, end_y, con->cursor_y,
+			con->margin_bottom, -(int)num, 0);
+
 	con->cursor_x = 0;
 	free(cache);
 }
@@ -1538,6 +1823,7 @@ void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i)
 		screen_cell_init(con, &cells[con->cursor_x + i]);
+	con->lines[con->cursor_y]->cell_age = con->age_cnt;
 }
 
 SHL_EXPORT
@@ -1573,6 +1859,7 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 
 	for (i = 0; i < num; ++i)
 		screen_cell_init(con, &cells[con->cursor_x + mv + i]);
+	con->lines[con->cursor_y]->cell_age = con->age_cnt;
 }
 
 SHL_EXPORT
@@ -1780,6 +2067,7 @@ bool tsm_screen_blink(struct tsm_screen *con)
 						res = true;
 					}
 					cell->age = con->age_cnt;
+					line->cell_age = con->age_cnt;
 				}
 			}
 		}
@@ -1787,3 +2075,46 @@ bool tsm_screen_blink(struct tsm_screen *con)
 
 	return res;
 }
+
+SHL_EXPORT
+int tsm_screen_get_symbol_stats(struct tsm_screen *con,
+				struct tsm_screen_symbol_stats *stats)
+{
+	struct tsm_symbol_stats st;
+	int ret;
+
+	if (!con || !stats)
+		return -EINVAL;
+
+	ret = screen_sym_mark(con);
+	if (ret)
+		return ret;
+
+	tsm_symbol_table_get_stats(con->sym_table, &st);
+	memset(stats, 0, sizeof(*stats));
+	stats->live = st.marked;
+	stats->dead = st.entries - st.marked;
+	stats->free_ids = st.free_ids;
+	stats->bytes = st.bytes;
+	stats->collections = st.collections;
+	stats->epoch = tsm_symbol_table_get_epoch(con->sym_table);
+	return 0;
+}
+
+SHL_EXPORT
+unsigned long tsm_screen_get_symbol_epoch(struct tsm_screen *con)
+{
+	if (!con)
+		return 0;
+
+	return tsm_symbol_table_get_epoch(con->sym_table);
+}
+
+SHL_EXPORT
+int tsm_screen_collect_symbols(struct tsm_screen *con)
+{
+	if (!con)
+		return -EINVAL;
+
+	return screen_sym_gc(con);
+}
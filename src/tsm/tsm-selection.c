@@ -53,92 +53,178 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wctype.h>
+#include <unistd.h>
 #include "libtsm.h"
 #include "libtsm-int.h"
 #include "shl-llog.h"
 
 #define LLOG_SUBSYSTEM "tsm-selection"
 
-static void selection_age(struct tsm_screen *con,
-                          const struct selection_pos *start,
-                          const struct selection_pos *end)
+/*
+ * Selection anchors are (line id, column) pairs, see screen_line_id(). Ids do
+ * not change when lines scroll into the scroll-back buffer or are dropped from
+ * it, so scrolling only updates anchors on rows that moved inside the scroll
+ * region. An anchor on a dropped line sorts before every remaining line.
+ * Lines are only looked up by id when the selection is changed or copied.
+ */
+
+static int selection_cmp(const struct selection_pos *a,
+			 const struct selection_pos *b)
 {
-	unsigned int i, j, k;
-	struct line *iter, *line = NULL;
-	bool in_sel = false, sel_start = false, sel_end = false;
+	if (a->id != b->id)
+		return a->id < b->id ? -1 : 1;
+	if (a->x != b->x)
+		return a->x < b->x ? -1 : 1;
+	return 0;
+}
 
-	iter = con->sb_pos;
-	k = 0;
+/* Return the first line with an id of at least *@id and store its id in
+ * @id, or NULL if there is none. Scroll-back lines are searched from the
+ * newest one, as selections are usually close to the screen. */
+static struct line *line_find(struct tsm_screen *con, uint64_t *id)
+{
+	struct line *iter;
 
-	if (start->line ? (!iter || start->line->sb_id < iter->sb_id) : (start->y == SELECTION_TOP))
-	{
-		in_sel = !in_sel;
+	if (*id > con->sb_last_id) {
+		if (*id - con->sb_last_id > con->size_y)
+			return NULL;
+		return con->lines[*id - con->sb_last_id - 1];
 	}
-	if (end->line ? (!iter || end->line->sb_id < iter->sb_id) : (end->y == SELECTION_TOP))
-	{
-		in_sel = !in_sel;
-		if (!in_sel)
-			return;
+
+	iter = con->sb_last;
+	while (iter && iter->prev && iter->prev->sb_id >= *id)
+		iter = iter->prev;
+
+	if (iter && iter->sb_id >= *id) {
+		*id = iter->sb_id;
+		return iter;
+	}
+
+	*id = screen_line_id(con, 0);
+	return con->lines[0];
+}
+
+/* Return the line after @line with id *@id, updating @id. */
+static struct line *line_next(struct tsm_screen *con, struct line *line,
+			      uint64_t *id)
+{
+	if (*id <= con->sb_last_id) {
+		if (line->next) {
+			*id = line->next->sb_id;
+			return line->next;
+		}
+
+		*id = screen_line_id(con, 0);
+		return con->lines[0];
+	}
+
+	if (*id - con->sb_last_id >= con->size_y)
+		return NULL;
+
+	return con->lines[(*id)++ - con->sb_last_id];
+}
+
+/* Return the line before @line with id *@id, updating @id. */
+static struct line *line_prev(struct tsm_screen *con, struct line *line,
+			      uint64_t *id)
+{
+	if (*id <= con->sb_last_id) {
+		if (!line->prev)
+			return NULL;
+
+		*id = line->prev->sb_id;
+		return line->prev;
+	}
+
+	if (*id > screen_line_id(con, 0))
+		return con->lines[--(*id) - con->sb_last_id - 1];
+
+	if (!con->sb_last)
+		return NULL;
+
+	*id = con->sb_last->sb_id;
+	return con->sb_last;
+}
+
+static unsigned int line_width(struct tsm_screen *con, struct line *line,
+			       uint64_t id)
+{
+	if (id <= con->sb_last_id || line->size < con->size_x)
+		return line->size;
+
+	return con->size_x;
+}
+
+/* Return the line at row @y of the visible area and store its id in @id. */
+static struct line *line_get(struct tsm_screen *con, unsigned int y,
+			     uint64_t *id)
+{
+	struct line *pos;
+
+	pos = con->sb_pos;
+
+	while (y && pos) {
+		--y;
+		pos = pos->next;
+	}
+
+	if (pos) {
+		*id = pos->sb_id;
+		return pos;
 	}
 
+	*id = screen_line_id(con, y);
+	return con->lines[y];
+}
+
+/* Mark all visible cells between @a and @b as changed. */
+static void selection_age(struct tsm_screen *con,
+                          const struct selection_pos *a,
+                          const struct selection_pos *b)
+{
+	const struct selection_pos *start = a, *end = b;
+	unsigned int i, j, k, from, to;
+	struct line *iter, *line;
+	uint64_t id;
+
+	if (selection_cmp(a, b) > 0) {
+		start = b;
+		end = a;
+	}
+
+	iter = con->sb_pos;
+	k = 0;
+
 	for (i = 0; i < con->size_y; ++i) {
 		if (iter) {
 			line = iter;
+			id = iter->sb_id;
 			iter = iter->next;
 		} else {
 			line = con->lines[k];
+			id = screen_line_id(con, k);
 			k++;
 		}
 
-		if (start->line == line || (!start->line && start->y == k - 1))
-			sel_start = true;
-		else
-			sel_start = false;
+		if (id < start->id || id > end->id)
+			continue;
 
-		if (end->line == line || (!end->line && end->y == k - 1))
-			sel_end = true;
-		else
-			sel_end = false;
-
-		if (sel_start && sel_end) {
-			if (start->x <= end->x) {
-				for (j = start->x; j <= end->x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			} else {
-				for (j = end->x; j <= start->x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			}
-		} else if (sel_start) {
-			if (in_sel) {
-				for (j = 0; j <= start->x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			} else {
-				for (j = start->x; j < con->size_x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			}
-			in_sel = !in_sel;
-		} else if (sel_end) {
-			if (in_sel) {
-				for (j = 0; j <= end->x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			} else {
-				for (j = end->x; j < con->size_x && j < line->size; ++j) {
-					line->cells[j].age = con->age_cnt;
-				}
-			}
-			in_sel = !in_sel;
-		} else if (in_sel) {
+		from = id == start->id ? start->x : 0;
+		to = id == end->id ? end->x : con->size_x - 1;
+
+		if (!from && id != end->id) {
 			line->age = con->age_cnt;
+			continue;
 		}
+
+		line->cell_age = con->age_cnt;
+		for (j = from; j <= to && j < line->size; ++j)
+			line->cells[j].age = con->age_cnt;
 	}
 }
 
@@ -154,9 +240,8 @@ static void selection_set(struct tsm_screen *con, struct selection_pos *sel,
 		pos = pos->next;
 	}
 
-		sel->line = pos;
+	sel->id = pos ? pos->sb_id : screen_line_id(con, y);
 	sel->x = x;
-	sel->y = y;
 }
 
 SHL_EXPORT
@@ -210,64 +295,162 @@ void tsm_screen_selection_target(struct tsm_screen *con,
 	selection_age(con, &old_end, &con->sel_end);
 }
 
-static struct line *line_get(struct tsm_screen *con,
-                             unsigned int y)
+/*
+ * Word and Line Selection
+ * Word boundaries come from the generated character-class table. A word is a
+ * maximal run of cells with the class of the clicked cell, where the ASCII
+ * characters in con->word_chars count as word characters so URLs and paths
+ * are selected as a whole. The trailing cell of a wide character belongs to
+ * the character before it. Runs continue across soft-wrapped line ends, both
+ * for words and for line selection. The alternate screen is never joined
+ * with the scroll-back buffer.
+ */
+
+#define WORD_CHARS_DEFAULT "-#%&+,./:=?@_~"
+
+SHL_EXPORT
+int tsm_screen_set_word_chars(struct tsm_screen *con, const char *chars)
 {
-	struct line *pos;
+	uint32_t map[4];
+	size_t i;
 
-	pos = con->sb_pos;
+	if (!con)
+		return -EINVAL;
 
-	while (y && pos) {
-		--y;
-		pos = pos->next;
+	if (!chars)
+		chars = WORD_CHARS_DEFAULT;
+
+	memset(map, 0, sizeof(map));
+	for (i = 0; chars[i]; ++i) {
+		if (chars[i] & 0x80)
+			return -EINVAL;
+		map[chars[i] / 32] |= 1U << (chars[i] % 32);
 	}
 
-	if (pos)
-		return pos;
+	memcpy(con->word_chars, map, sizeof(map));
+	return 0;
+}
 
-	return con->lines[y];
+static struct line *wrap_prev(struct tsm_screen *con, struct line *line,
+			      uint64_t *id)
+{
+	if ((con->flags & TSM_SCREEN_ALTERNATE) &&
+	    *id == screen_line_id(con, 0))
+		return NULL;
+
+	return line_prev(con, line, id);
+}
+
+static struct line *wrap_next(struct tsm_screen *con, struct line *line,
+			      uint64_t *id)
+{
+	if ((con->flags & TSM_SCREEN_ALTERNATE) && *id <= con->sb_last_id)
+		return NULL;
+
+	return line_next(con, line, id);
 }
 
+static unsigned int cell_class(struct tsm_screen *con, const struct line *line,
+			       unsigned int x)
+{
+	const uint32_t *ch;
+	tsm_symbol_t sym;
+
+	while (x > 0 && !line->cells[x].width)
+		--x;
+
+	sym = line->cells[x].ch;
+	ch = tsm_symbol_get(con->sym_table, &sym, NULL);
+	if (*ch < 128 && (con->word_chars[*ch / 32] & (1U << (*ch % 32))))
+		return TSM_UCLASS_WORD;
+
+	return tsm_ucs4_get_class(*ch);
+}
+
+SHL_EXPORT
 void tsm_screen_selection_word(struct tsm_screen *con,
                                unsigned int posx,
                                unsigned int posy)
 {
-	struct line *line;
+	struct selection_pos start, end;
+	struct line *line, *origin, *tmp;
+	unsigned int cls, width;
+	uint64_t id;
 
-	if (!con)
+	if (!con || posy >= con->size_y)
 		return;
 
-	if (con->sel_active)
-		selection_age(con, &con->sel_start, &con->sel_end);
+	origin = line_get(con, posy, &start.id);
+	if (posx >= line_width(con, origin, start.id))
+		return;
+	end.id = start.id;
 
-	line = line_get(con, posy);
+	cls = cell_class(con, origin, posx);
+	if (cls == TSM_UCLASS_SPACE)
+		return;
 
-	if (posx < line->size && iswalnum(line->cells[posx].ch))
-	{
-		int i;
-		unsigned int startx, endx;
+	/* extend to the left, continuing at the end of a wrapped line */
+	line = origin;
+	start.x = posx;
+	while (true) {
+		while (start.x > 0 && cell_class(con, line, start.x - 1) == cls)
+			--start.x;
+		if (start.x > 0)
+			break;
 
-		screen_inc_age(con);
+		id = start.id;
+		tmp = wrap_prev(con, line, &id);
+		if (!tmp || !tmp->wrapped)
+			break;
+		width = line_width(con, tmp, id);
+		if (!width || cell_class(con, tmp, width - 1) != cls)
+			break;
+		line = tmp;
+		start.id = id;
+		start.x = width - 1;
+	}
 
-		for (i = posx - 1; i >= 0 && iswalnum(line->cells[i].ch); i--);
-		startx = i + 1;
+	/* extend to the right, continuing at the start of the next line */
+	line = origin;
+	end.x = posx;
+	while (true) {
+		width = line_width(con, line, end.id);
+		while (end.x + 1 < width &&
+		       cell_class(con, line, end.x + 1) == cls)
+			++end.x;
+		if (end.x + 1 < width || !line->wrapped)
+			break;
 
-		for (i = posx + 1; i < line->size && iswalnum(line->cells[i].ch); i++);
-		endx = i - 1;
+		id = end.id;
+		tmp = wrap_next(con, line, &id);
+		if (!tmp || !line_width(con, tmp, id) ||
+		    cell_class(con, tmp, 0) != cls)
+			break;
+		line = tmp;
+		end.id = id;
+		end.x = 0;
+	}
 
-		con->sel_active = true;
-		selection_set(con, &con->sel_start, startx, posy);
-		memcpy(&con->sel_end, &con->sel_start, sizeof(con->sel_end));
-		con->sel_end.x = endx;
+	screen_inc_age(con);
 
+	if (con->sel_active)
 		selection_age(con, &con->sel_start, &con->sel_end);
-	}
+
+	con->sel_active = true;
+	con->sel_start = start;
+	con->sel_end = end;
+
+	selection_age(con, &con->sel_start, &con->sel_end);
 }
 
+SHL_EXPORT
 void tsm_screen_selection_line(struct tsm_screen *con,
                                unsigned int posy)
 {
-	if (!con)
+	struct line *line, *tmp;
+	uint64_t id;
+
+	if (!con || posy >= con->size_y)
 		return;
 
 	screen_inc_age(con);
@@ -275,297 +458,438 @@ void tsm_screen_selection_line(struct tsm_screen *con,
 	if (con->sel_active)
 		selection_age(con, &con->sel_start, &con->sel_end);
 
-	con->sel_active = true;
-	selection_set(con, &con->sel_start, 0, posy);
-	memcpy(&con->sel_end, &con->sel_start, sizeof(con->sel_end));
+	/* select the whole logical line across soft-wraps */
+	line = line_get(con, posy, &con->sel_start.id);
+	id = con->sel_start.id;
+	while ((tmp = wrap_prev(con, line, &id)) && tmp->wrapped) {
+		line = tmp;
+		con->sel_start.id = id;
+	}
+	con->sel_start.x = 0;
+
+	line = line_get(con, posy, &con->sel_end.id);
+	id = con->sel_end.id;
+	while (line->wrapped && (line = wrap_next(con, line, &id)))
+		con->sel_end.id = id;
 	con->sel_end.x = con->size_x - 1;
 
+	con->sel_active = true;
 	selection_age(con, &con->sel_start, &con->sel_end);
 }
 
-/* TODO: tsm_ucs4_to_utf8 expects UCS4 characters, but a cell contains a
- * tsm-symbol (which can contain multiple UCS4 chars). Fix this when introducing
- * support for combining characters. */
-static unsigned int copy_line(struct line *line, char *buf,
-			      unsigned int start, unsigned int len)
+/*
+ * Copying
+ * All copy functions share one line walker. It visits the selected part of
+ * each line in order and hands it to a sink, which either only counts the
+ * bytes, writes into a buffer of exactly that size or streams into a write
+ * callback in bounded chunks. Trailing blanks of each line are dropped and
+ * lines are separated by "\n", except for soft-wrapped lines which are joined
+ * with the next line as is.
+ */
+
+struct copy_sink {
+	char *pos;			/* buffer to write into or NULL */
+	size_t len;			/* number of bytes produced */
+	struct screen_out *out;		/* stream to write into or NULL */
+};
+
+static void copy_put(struct copy_sink *sink, const char *u8, size_t len)
 {
-	unsigned int i, end;
-	char *pos = buf;
+	if (sink->out) {
+		screen_out_put(sink->out, u8, len);
+	} else if (sink->pos) {
+		memcpy(sink->pos, u8, len);
+		sink->pos += len;
+	}
 
-	end = start + len;
-	for (i = start; i < line->size && i < end; ++i) {
-		if (line->cells[i].ch != '\0')
-			pos += tsm_ucs4_to_utf8(line->cells[i].ch, pos);
+	sink->len += len;
+}
+
+/* code points collected before they are encoded in one go */
+#define COPY_BATCH 256
+
+static void copy_put_ucs4(struct copy_sink *sink, const uint32_t *ucs4,
+			  size_t len)
+{
+	char buf[COPY_BATCH * 4];
+	size_t n;
+
+	if (sink->out) {
+		n = tsm_ucs4_to_utf8_bulk(ucs4, len, buf);
+		screen_out_put(sink->out, buf, n);
+	} else if (sink->pos) {
+		n = tsm_ucs4_to_utf8_bulk(ucs4, len, sink->pos);
+		sink->pos += n;
+	} else {
+		n = tsm_ucs4_to_utf8_bulk(ucs4, len, NULL);
 	}
 
-	return pos - buf;
+	sink->len += n;
 }
 
-/* TODO: This beast definitely needs some "beautification", however, it's meant
- * as a "proof-of-concept" so its enough for now. */
-SHL_EXPORT
-int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
+/* Copy @len cells of @line starting at @start. Wide characters are copied
+ * once and combined symbols are resolved to all their code points. */
+static void copy_line(struct tsm_screen *con, struct copy_sink *sink,
+		      struct line *line, unsigned int start, unsigned int len)
 {
-	unsigned int len, i;
-	struct selection_pos *start, *end;
-	struct line *iter;
-	char *str, *pos;
+	unsigned int i, end;
+	const struct cell *cell;
+	const uint32_t *ch;
+	uint32_t batch[COPY_BATCH];
+	tsm_symbol_t sym;
+	size_t j, n, num = 0;
 
-	if (!con || !out)
-		return -EINVAL;
+	end = start + len;
+	if (end > line->size)
+		end = line->size;
 
-	if (!con->sel_active)
-		return -ENOENT;
+	while (end > start && !line->wrapped) {
+		cell = &line->cells[end - 1];
+		if (cell->width && cell->ch && cell->ch != ' ')
+			break;
+		--end;
+	}
 
-	/* check whether sel_start or sel_end comes first */
-	if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP) {
-		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP) {
-			str = strdup("");
-			if (!str)
-				return -ENOMEM;
-			*out = str;
-			return 0;
-		}
-		start = &con->sel_start;
-		end = &con->sel_end;
-	} else if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP) {
-		start = &con->sel_end;
-		end = &con->sel_start;
-	} else if (con->sel_start.line && con->sel_end.line) {
-		if (con->sel_start.line->sb_id < con->sel_end.line->sb_id) {
-			start = &con->sel_start;
-			end = &con->sel_end;
-		} else if (con->sel_start.line->sb_id > con->sel_end.line->sb_id) {
-			start = &con->sel_end;
-			end = &con->sel_start;
-		} else if (con->sel_start.x < con->sel_end.x) {
-			start = &con->sel_start;
-			end = &con->sel_end;
-		} else {
-			start = &con->sel_end;
-			end = &con->sel_start;
+	for (i = start; i < end; ++i) {
+		cell = &line->cells[i];
+		if (!cell->width)
+			continue;
+
+		sym = cell->ch ? cell->ch : ' ';
+		ch = tsm_symbol_get(con->sym_table, &sym, &n);
+		if (num + n > COPY_BATCH) {
+			copy_put_ucs4(sink, batch, num);
+			num = 0;
 		}
-	} else if (con->sel_start.line) {
-		start = &con->sel_start;
-		end = &con->sel_end;
-	} else if (con->sel_end.line) {
-		start = &con->sel_end;
-		end = &con->sel_start;
-	} else if (con->sel_start.y < con->sel_end.y) {
-		start = &con->sel_start;
-		end = &con->sel_end;
-	} else if (con->sel_start.y > con->sel_end.y) {
-		start = &con->sel_end;
-		end = &con->sel_start;
-	} else if (con->sel_start.x < con->sel_end.x) {
-		start = &con->sel_start;
-		end = &con->sel_end;
+		for (j = 0; j < n; ++j)
+			batch[num++] = ch[j];
+	}
+
+	if (num)
+		copy_put_ucs4(sink, batch, num);
+}
+
+/* Order the selection ends. Returns false if the selection is empty. */
+static bool selection_order(struct tsm_screen *con,
+			    struct selection_pos **start,
+			    struct selection_pos **end)
+{
+	if (selection_cmp(&con->sel_start, &con->sel_end) <= 0) {
+		*start = &con->sel_start;
+		*end = &con->sel_end;
 	} else {
-		start = &con->sel_end;
-		end = &con->sel_start;
+		*start = &con->sel_end;
+		*end = &con->sel_start;
 	}
 
-	/* calculate size of buffer */
-	len = 0;
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
-
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
-			if (iter->size > start->x) {
-				if (iter->size > end->x)
-					len += end->x - start->x + 1;
-				else
-					len += iter->size - start->x;
-			}
-			break;
-		} else if (iter == start->line) {
-			if (iter->size > start->x)
-				len += iter->size - start->x;
-		} else if (iter == end->line) {
-			if (iter->size > end->x)
-				len += end->x + 1;
-			else
-				len += iter->size;
-			break;
-		} else {
-			len += iter->size;
-		}
+	/* both ends were dropped from the scroll-back buffer */
+	return (*end)->id >= screen_first_id(con);
+}
 
-		++len;
-		iter = iter->next;
+static void selection_walk(struct tsm_screen *con, struct copy_sink *sink,
+			   const struct selection_pos *start,
+			   const struct selection_pos *end)
+{
+	struct line *line;
+	unsigned int from, to, width;
+	uint64_t id;
+
+	id = start->id;
+	line = line_find(con, &id);
+
+	while (line && id <= end->id) {
+		width = line_width(con, line, id);
+		from = id == start->id ? start->x : 0;
+		to = id == end->id ? end->x + 1 : width;
+		if (to > width)
+			to = width;
+		if (to > from)
+			copy_line(con, sink, line, from, to - from);
+
+		if (id == end->id)
+			return;
+		if (!line->wrapped)
+			copy_put(sink, "\n", 1);
+		line = line_next(con, line, &id);
 	}
+}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
-			i = 0;
-		else
-			i = start->y;
-		for ( ; i < con->size_y; ++i) {
-			if (!start->line && start->y == i && end->y == i) {
-				if (con->size_x > start->x) {
-					if (con->size_x > end->x)
-						len += end->x - start->x + 1;
-					else
-						len += con->size_x - start->x;
-				}
-				break;
-			} else if (!start->line && start->y == i) {
-				if (con->size_x > start->x)
-					len += con->size_x - start->x;
-			} else if (end->y == i) {
-				if (con->size_x > end->x)
-					len += end->x + 1;
-				else
-					len += con->size_x;
-				break;
-			} else {
-				len += con->size_x;
-			}
-
-			++len;
-		}
+static void copy_all_walk(struct tsm_screen *con, struct copy_sink *sink)
+{
+	struct line *iter;
+	unsigned int i;
+
+	for (iter = con->sb_first; iter; iter = iter->next) {
+		copy_line(con, sink, iter, 0, iter->size);
+		if (!iter->wrapped)
+			copy_put(sink, "\n", 1);
+	}
+
+	for (i = 0; i < con->size_y; ++i) {
+		copy_line(con, sink, con->lines[i], 0, con->size_x);
+		if (!con->lines[i]->wrapped)
+			copy_put(sink, "\n", 1);
 	}
+}
+
+/* Run @walk twice: once to size the buffer exactly, once to fill it. */
+static int copy_alloc(struct tsm_screen *con, char **out,
+		      const struct selection_pos *start,
+		      const struct selection_pos *end)
+{
+	struct copy_sink sink;
+	char *str;
+
+	memset(&sink, 0, sizeof(sink));
+	if (start)
+		selection_walk(con, &sink, start, end);
+	else
+		copy_all_walk(con, &sink);
 
-	/* allocate buffer */
-	len *= 4;
-	++len;
-	str = malloc(len);
+	if (sink.len > INT_MAX)
+		return -EFBIG;
+
+	str = malloc(sink.len + 1);
 	if (!str)
 		return -ENOMEM;
-	pos = str;
-
-	/* copy data into buffer */
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
-
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
-			if (iter->size > start->x) {
-				if (iter->size > end->x)
-					len = end->x - start->x + 1;
-				else
-					len = iter->size - start->x;
-				pos += copy_line(iter, pos, start->x, len);
-			}
-			break;
-		} else if (iter == start->line) {
-			if (iter->size > start->x)
-				pos += copy_line(iter, pos, start->x,
-						 iter->size - start->x);
-		} else if (iter == end->line) {
-			if (iter->size > end->x)
-				len = end->x + 1;
-			else
-				len = iter->size;
-			pos += copy_line(iter, pos, 0, len);
-			break;
-		} else {
-			pos += copy_line(iter, pos, 0, iter->size);
-		}
 
-		*pos++ = '\n';
-		iter = iter->next;
+	memset(&sink, 0, sizeof(sink));
+	sink.pos = str;
+	if (start)
+		selection_walk(con, &sink, start, end);
+	else
+		copy_all_walk(con, &sink);
+
+	*sink.pos = 0;
+	*out = str;
+	return sink.len;
+}
+
+/*
+ * Parallel Copy
+ * Copying the whole history is split into chunks of consecutive lines. All
+ * chunks are first sized concurrently, a prefix sum over their sizes yields
+ * the offset of each chunk in the result and then all chunks are encoded into
+ * their slice of the buffer concurrently. The first chunk runs on the caller.
+ * The screen is only read while copying.
+ */
+
+#define COPY_CHUNK_MIN 1024
+
+struct copy_chunk {
+	struct tsm_screen *con;
+	struct line **lines;
+	unsigned int first;
+	unsigned int num;
+	struct copy_sink sink;
+	pthread_t thread;
+	bool running;
+};
+
+static void *copy_chunk_fn(void *arg)
+{
+	struct copy_chunk *chunk = arg;
+	struct tsm_screen *con = chunk->con;
+	struct line *line;
+	unsigned int i, width;
+
+	for (i = chunk->first; i < chunk->first + chunk->num; ++i) {
+		line = chunk->lines[i];
+		width = i < con->sb_count ? line->size : con->size_x;
+		copy_line(con, &chunk->sink, line, 0, width);
+		if (!line->wrapped)
+			copy_put(&chunk->sink, "\n", 1);
 	}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
-			i = 0;
+	return NULL;
+}
+
+static void copy_chunks_run(struct copy_chunk *chunks, unsigned int num)
+{
+	unsigned int i;
+	int r;
+
+	for (i = 1; i < num; ++i) {
+		r = pthread_create(&chunks[i].thread, NULL, copy_chunk_fn,
+				   &chunks[i]);
+		if (r)
+			llog_debug(chunks[i].con, "cannot spawn copy thread (%d)",
+				   r);
 		else
-			i = start->y;
-		for ( ; i < con->size_y; ++i) {
-			iter = con->lines[i];
-			if (!start->line && start->y == i && end->y == i) {
-				if (con->size_x > start->x) {
-					if (con->size_x > end->x)
-						len = end->x - start->x + 1;
-					else
-						len = con->size_x - start->x;
-					pos += copy_line(iter, pos, start->x, len);
-				}
-				break;
-			} else if (!start->line && start->y == i) {
-				if (con->size_x > start->x)
-					pos += copy_line(iter, pos, start->x,
-							 con->size_x - start->x);
-			} else if (end->y == i) {
-				if (con->size_x > end->x)
-					len = end->x + 1;
-				else
-					len = con->size_x;
-				pos += copy_line(iter, pos, 0, len);
-				break;
-			} else {
-				pos += copy_line(iter, pos, 0, con->size_x);
-			}
-
-			*pos++ = '\n';
-		}
+			chunks[i].running = true;
+	}
+
+	copy_chunk_fn(&chunks[0]);
+
+	for (i = 1; i < num; ++i) {
+		if (chunks[i].running)
+			pthread_join(chunks[i].thread, NULL);
+		else
+			copy_chunk_fn(&chunks[i]);
+		chunks[i].running = false;
+	}
+}
+
+static int copy_all_parallel(struct tsm_screen *con, char **out)
+{
+	struct copy_chunk *chunks;
+	struct line **lines, *iter;
+	unsigned int i, num, nchunks, first;
+	size_t len;
+	long cpus;
+	char *str;
+	int r;
+
+	num = con->sb_count + con->size_y;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nchunks = num / COPY_CHUNK_MIN;
+	if (cpus > 0 && nchunks > cpus)
+		nchunks = cpus;
+	if (cpus <= 1 || nchunks <= 1)
+		return copy_alloc(con, out, NULL, NULL);
+
+	lines = malloc(sizeof(*lines) * num);
+	chunks = calloc(nchunks, sizeof(*chunks));
+	if (!lines || !chunks) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	i = 0;
+	for (iter = con->sb_first; iter && i < con->sb_count; iter = iter->next)
+		lines[i++] = iter;
+	if (i != con->sb_count || iter) {
+		llog_warning(con, "scrollback count out of sync");
+		r = copy_alloc(con, out, NULL, NULL);
+		goto out_free;
+	}
+	memcpy(&lines[i], con->lines, sizeof(*lines) * con->size_y);
+
+	for (i = 0, first = 0; i < nchunks; ++i) {
+		chunks[i].con = con;
+		chunks[i].lines = lines;
+		chunks[i].first = first;
+		chunks[i].num = ((uint64_t)num * (i + 1)) / nchunks - first;
+		first += chunks[i].num;
 	}
 
-	/* return buffer */
-	*pos = 0;
+	/* size pass */
+	copy_chunks_run(chunks, nchunks);
+
+	for (i = 0, len = 0; i < nchunks; ++i)
+		len += chunks[i].sink.len;
+	if (len > INT_MAX) {
+		r = -EFBIG;
+		goto out_free;
+	}
+
+	str = malloc(len + 1);
+	if (!str) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	/* encode pass, each chunk writes at its prefix-summed offset */
+	for (i = 0, len = 0; i < nchunks; ++i) {
+		chunks[i].sink.pos = &str[len];
+		len += chunks[i].sink.len;
+		chunks[i].sink.len = 0;
+	}
+	copy_chunks_run(chunks, nchunks);
+
+	str[len] = 0;
 	*out = str;
-	return pos - str;
+	r = len;
+
+out_free:
+	free(chunks);
+	free(lines);
+	return r;
+}
+
+static int copy_stream(struct tsm_screen *con, tsm_screen_write_cb write_cb,
+		       void *data, const struct selection_pos *start,
+		       const struct selection_pos *end)
+{
+	struct screen_out *out;
+	struct copy_sink sink;
+
+	out = malloc(sizeof(*out));
+	if (!out)
+		return -ENOMEM;
+	memset(out, 0, sizeof(*out));
+	out->con = con;
+	out->write_cb = write_cb;
+	out->data = data;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.out = out;
+	if (start)
+		selection_walk(con, &sink, start, end);
+	else
+		copy_all_walk(con, &sink);
+
+	screen_out_flush(out);
+	free(out);
+	return 0;
 }
 
 SHL_EXPORT
-int tsm_screen_copy_all(struct tsm_screen *con, char **out)
+int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 {
-	unsigned int len, i;
-	struct line *iter;
-	char *str, *pos;
+	struct selection_pos *start, *end;
+	char *str;
 
 	if (!con || !out)
 		return -EINVAL;
 
-	/* calculate size of buffer */
-	len = 0;
-	iter = con->sb_first;
-
-	while (iter) {
-		len += iter->size;
+	if (!con->sel_active)
+		return -ENOENT;
 
-		++len;
-		iter = iter->next;
+	if (!selection_order(con, &start, &end)) {
+		str = strdup("");
+		if (!str)
+			return -ENOMEM;
+		*out = str;
+		return 0;
 	}
 
-	for (i = 0; i < con->size_y; ++i) {
-		len += con->size_x;
+	return copy_alloc(con, out, start, end);
+}
 
-		++len;
-	}
+SHL_EXPORT
+int tsm_screen_selection_copy_cb(struct tsm_screen *con,
+				 tsm_screen_write_cb write_cb, void *data)
+{
+	struct selection_pos *start, *end;
 
-	/* allocate buffer */
-	len *= 4;
-	++len;
-	str = malloc(len);
-	if (!str)
-		return -ENOMEM;
-	pos = str;
+	if (!con || !write_cb)
+		return -EINVAL;
 
-	/* copy data into buffer */
-	iter = con->sb_first;
+	if (!con->sel_active)
+		return -ENOENT;
 
-	while (iter) {
-		pos += copy_line(iter, pos, 0, iter->size);
+	if (!selection_order(con, &start, &end))
+		return 0;
 
-		*pos++ = '\n';
-		iter = iter->next;
-	}
+	return copy_stream(con, write_cb, data, start, end);
+}
 
-	for (i = 0; i < con->size_y; ++i) {
-		iter = con->lines[i];
+SHL_EXPORT
+int tsm_screen_copy_all(struct tsm_screen *con, char **out)
+{
+	if (!con || !out)
+		return -EINVAL;
 
-		pos += copy_line(iter, pos, 0, con->size_x);
+	return copy_all_parallel(con, out);
+}
 
-		*pos++ = '\n';
-	}
+SHL_EXPORT
+int tsm_screen_copy_all_cb(struct tsm_screen *con,
+			   tsm_screen_write_cb write_cb, void *data)
+{
+	if (!con || !write_cb)
+		return -EINVAL;
 
-	/* return buffer */
-	*pos = 0;
-	*out = str;
-	return pos - str;
+	return copy_stream(con, write_cb, data, NULL, NULL);
 }
@@ -0,0 +1,545 @@
+/*
+ * libtsm - Unicode Table Generator
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Unicode Table Generator
+ * This host tool writes tsm-unicode-tables.h, which contains compact
+ * two-level lookup tables for per-code-point properties. The output is
+ * committed to the source tree and refreshed by the tsm-unicode-tables build
+ * target, so building libtsm never runs it.
+ * The code space is split into blocks of 256 code points. Identical blocks
+ * are stored once and a first-level index maps each block number to its
+ * data, so every lookup is two array accesses.
+ *
+ * Character classes are packed with 2 bits per code point. The values must
+ * match enum tsm_uclass in libtsm-int.h.
+ * Display widths are taken from tsm_wcwidth() and also packed with 2 bits per
+ * code point. After updating the Unicode version of external/wcwidth, run the
+ * tsm-unicode-tables target to regenerate them.
+ * Grapheme break properties (UAX #29) are packed with 4 bits per code point
+ * and must match enum tsm_gbp in libtsm-int.h. Extend is derived from the
+ * zero-width code points of tsm_wcwidth(), everything else is listed below.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wcwidth/wcwidth.h"
+
+#define UCS4_NUM 0x110000
+#define BLOCK_SHIFT 8
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define BLOCK_NUM (UCS4_NUM / BLOCK_SIZE)
+
+enum uclass {
+	UCLASS_SPACE,
+	UCLASS_WORD,
+	UCLASS_PUNCT,
+	UCLASS_CJK,
+};
+
+enum gbp {
+	GBP_OTHER,
+	GBP_CR,
+	GBP_LF,
+	GBP_CONTROL,
+	GBP_EXTEND,
+	GBP_ZWJ,
+	GBP_RI,
+	GBP_PREPEND,
+	GBP_SPACINGMARK,
+	GBP_L,
+	GBP_V,
+	GBP_T,
+	GBP_LV,
+	GBP_LVT,
+	GBP_EXTPICT,
+};
+
+struct range {
+	uint32_t first;
+	uint32_t last;
+};
+
+/* Anything not listed below is a word character. */
+
+static const struct range space_ranges[] = {
+	{ 0x0000, 0x0020 },
+	{ 0x007f, 0x00a0 },
+	{ 0x1680, 0x1680 },
+	{ 0x2000, 0x200b },
+	{ 0x2028, 0x2029 },
+	{ 0x202f, 0x202f },
+	{ 0x205f, 0x205f },
+	{ 0x3000, 0x3000 },
+	{ 0xfeff, 0xfeff },
+};
+
+static const struct range punct_ranges[] = {
+	{ 0x0021, 0x002f },
+	{ 0x003a, 0x0040 },
+	{ 0x005b, 0x0060 },
+	{ 0x007b, 0x007e },
+	{ 0x00a1, 0x00a9 },
+	{ 0x00ab, 0x00b4 },
+	{ 0x00b6, 0x00b9 },
+	{ 0x00bb, 0x00bf },
+	{ 0x00d7, 0x00d7 },
+	{ 0x00f7, 0x00f7 },
+	{ 0x037e, 0x037e },
+	{ 0x0387, 0x0387 },
+	{ 0x055a, 0x055f },
+	{ 0x0589, 0x058a },
+	{ 0x05be, 0x05be },
+	{ 0x05c0, 0x05c0 },
+	{ 0x05c3, 0x05c3 },
+	{ 0x05c6, 0x05c6 },
+	{ 0x05f3, 0x05f4 },
+	{ 0x0609, 0x060d },
+	{ 0x061b, 0x061f },
+	{ 0x066a, 0x066d },
+	{ 0x06d4, 0x06d4 },
+	{ 0x0964, 0x0965 },
+	{ 0x0970, 0x0970 },
+	{ 0x0e4f, 0x0e4f },
+	{ 0x0e5a, 0x0e5b },
+	{ 0x10fb, 0x10fb },
+	{ 0x2010, 0x2027 },
+	{ 0x2030, 0x205e },
+	{ 0x207a, 0x207e },
+	{ 0x208a, 0x208e },
+	{ 0x20a0, 0x20cf },
+	{ 0x2100, 0x2101 },
+	{ 0x2103, 0x2106 },
+	{ 0x2108, 0x2109 },
+	{ 0x2114, 0x2114 },
+	{ 0x2116, 0x2118 },
+	{ 0x211e, 0x2123 },
+	{ 0x2125, 0x2125 },
+	{ 0x2127, 0x2127 },
+	{ 0x2129, 0x2129 },
+	{ 0x212e, 0x212e },
+	{ 0x213a, 0x213b },
+	{ 0x2140, 0x2144 },
+	{ 0x214a, 0x214d },
+	{ 0x214f, 0x214f },
+	{ 0x2190, 0x2bff },
+	{ 0x2e00, 0x2e7f },
+	{ 0x3001, 0x3004 },
+	{ 0x3008, 0x3020 },
+	{ 0x3030, 0x3030 },
+	{ 0x303d, 0x303f },
+	{ 0x30a0, 0x30a0 },
+	{ 0x30fb, 0x30fb },
+	{ 0xfd3e, 0xfd3f },
+	{ 0xfe10, 0xfe19 },
+	{ 0xfe30, 0xfe6b },
+	{ 0xff01, 0xff0f },
+	{ 0xff1a, 0xff20 },
+	{ 0xff3b, 0xff40 },
+	{ 0xff5b, 0xff65 },
+	{ 0xffe0, 0xffee },
+	{ 0x1f000, 0x1faff },
+};
+
+static const struct range cjk_ranges[] = {
+	{ 0x2e80, 0x2fdf },
+	{ 0x3005, 0x3007 },
+	{ 0x3021, 0x3029 },
+	{ 0x3031, 0x303c },
+	{ 0x3041, 0x309f },
+	{ 0x30a1, 0x30fa },
+	{ 0x30fc, 0x30ff },
+	{ 0x3105, 0x312f },
+	{ 0x3190, 0x31ff },
+	{ 0x3400, 0x4dbf },
+	{ 0x4e00, 0x9fff },
+	{ 0xf900, 0xfaff },
+	{ 0xff66, 0xff9f },
+	{ 0x20000, 0x3ffff },
+};
+
+/* Grapheme break properties. Spacing marks are only listed for the major
+ * Indic scripts; as they have a width they never join a cell anyway. */
+
+static const struct range gbp_control_ranges[] = {
+	{ 0x0000, 0x001f },
+	{ 0x007f, 0x009f },
+	{ 0x061c, 0x061c },
+	{ 0x180e, 0x180e },
+	{ 0x200b, 0x200b },
+	{ 0x200e, 0x200f },
+	{ 0x2028, 0x202e },
+	{ 0x2060, 0x206f },
+	{ 0xfeff, 0xfeff },
+	{ 0xfff0, 0xfffb },
+	{ 0xe0000, 0xe001f },
+	{ 0xe0080, 0xe00ff },
+	{ 0xe01f0, 0xe0fff },
+};
+
+static const struct range gbp_extend_ranges[] = {
+	{ 0x200c, 0x200c },
+	{ 0x1f3fb, 0x1f3ff },
+	{ 0xe0020, 0xe007f },
+};
+
+static const struct range gbp_prepend_ranges[] = {
+	{ 0x0600, 0x0605 },
+	{ 0x06dd, 0x06dd },
+	{ 0x070f, 0x070f },
+	{ 0x0890, 0x0891 },
+	{ 0x08e2, 0x08e2 },
+	{ 0x0d4e, 0x0d4e },
+	{ 0x110bd, 0x110bd },
+	{ 0x110cd, 0x110cd },
+	{ 0x111c2, 0x111c3 },
+};
+
+static const struct range gbp_spacingmark_ranges[] = {
+	{ 0x0903, 0x0903 },
+	{ 0x093b, 0x093b },
+	{ 0x093e, 0x0940 },
+	{ 0x0949, 0x094c },
+	{ 0x094e, 0x094f },
+	{ 0x0982, 0x0983 },
+	{ 0x09bf, 0x09c0 },
+	{ 0x09c7, 0x09c8 },
+	{ 0x09cb, 0x09cc },
+	{ 0x0a03, 0x0a03 },
+	{ 0x0a3e, 0x0a40 },
+	{ 0x0a83, 0x0a83 },
+	{ 0x0abe, 0x0ac0 },
+	{ 0x0ac9, 0x0ac9 },
+	{ 0x0acb, 0x0acc },
+	{ 0x0b02, 0x0b03 },
+	{ 0x0bbf, 0x0bbf },
+	{ 0x0bc1, 0x0bc2 },
+	{ 0x0bc6, 0x0bc8 },
+	{ 0x0bca, 0x0bcc },
+	{ 0x0c01, 0x0c03 },
+	{ 0x0c41, 0x0c44 },
+	{ 0x0c82, 0x0c83 },
+	{ 0x0d02, 0x0d03 },
+	{ 0x0d3f, 0x0d40 },
+	{ 0x0d46, 0x0d48 },
+	{ 0x0d4a, 0x0d4c },
+	{ 0x0d82, 0x0d83 },
+	{ 0x0dd0, 0x0dd1 },
+	{ 0x0dd8, 0x0dde },
+	{ 0x0df2, 0x0df3 },
+	{ 0x0e33, 0x0e33 },
+	{ 0x0eb3, 0x0eb3 },
+	{ 0x0f3e, 0x0f3f },
+	{ 0x0f7f, 0x0f7f },
+	{ 0x1031, 0x1031 },
+	{ 0x103b, 0x103c },
+	{ 0x1056, 0x1057 },
+	{ 0x1084, 0x1084 },
+	{ 0x17b6, 0x17b6 },
+	{ 0x17be, 0x17c5 },
+	{ 0x17c7, 0x17c8 },
+};
+
+static const struct range gbp_l_ranges[] = {
+	{ 0x1100, 0x115f },
+	{ 0xa960, 0xa97c },
+};
+
+static const struct range gbp_v_ranges[] = {
+	{ 0x1160, 0x11a7 },
+	{ 0xd7b0, 0xd7c6 },
+};
+
+static const struct range gbp_t_ranges[] = {
+	{ 0x11a8, 0x11ff },
+	{ 0xd7cb, 0xd7fb },
+};
+
+static const struct range gbp_extpict_ranges[] = {
+	{ 0x00a9, 0x00a9 },
+	{ 0x00ae, 0x00ae },
+	{ 0x203c, 0x203c },
+	{ 0x2049, 0x2049 },
+	{ 0x2122, 0x2122 },
+	{ 0x2139, 0x2139 },
+	{ 0x2194, 0x2199 },
+	{ 0x21a9, 0x21aa },
+	{ 0x231a, 0x231b },
+	{ 0x2328, 0x2328 },
+	{ 0x2388, 0x2388 },
+	{ 0x23cf, 0x23cf },
+	{ 0x23e9, 0x23f3 },
+	{ 0x23f8, 0x23fa },
+	{ 0x24c2, 0x24c2 },
+	{ 0x25aa, 0x25ab },
+	{ 0x25b6, 0x25b6 },
+	{ 0x25c0, 0x25c0 },
+	{ 0x25fb, 0x25fe },
+	{ 0x2600, 0x2605 },
+	{ 0x2607, 0x2612 },
+	{ 0x2614, 0x2685 },
+	{ 0x2690, 0x2705 },
+	{ 0x2708, 0x2712 },
+	{ 0x2714, 0x2714 },
+	{ 0x2716, 0x2716 },
+	{ 0x271d, 0x271d },
+	{ 0x2721, 0x2721 },
+	{ 0x2728, 0x2728 },
+	{ 0x2733, 0x2734 },
+	{ 0x2744, 0x2744 },
+	{ 0x2747, 0x2747 },
+	{ 0x274c, 0x274c },
+	{ 0x274e, 0x274e },
+	{ 0x2753, 0x2755 },
+	{ 0x2757, 0x2757 },
+	{ 0x2763, 0x2767 },
+	{ 0x2795, 0x2797 },
+	{ 0x27a1, 0x27a1 },
+	{ 0x27b0, 0x27b0 },
+	{ 0x27bf, 0x27bf },
+	{ 0x2934, 0x2935 },
+	{ 0x2b05, 0x2b07 },
+	{ 0x2b1b, 0x2b1c },
+	{ 0x2b50, 0x2b50 },
+	{ 0x2b55, 0x2b55 },
+	{ 0x3030, 0x3030 },
+	{ 0x303d, 0x303d },
+	{ 0x3297, 0x3297 },
+	{ 0x3299, 0x3299 },
+	{ 0x1f000, 0x1f0ff },
+	{ 0x1f10d, 0x1f10f },
+	{ 0x1f12f, 0x1f12f },
+	{ 0x1f16c, 0x1f171 },
+	{ 0x1f17e, 0x1f17f },
+	{ 0x1f18e, 0x1f18e },
+	{ 0x1f191, 0x1f19a },
+	{ 0x1f1ad, 0x1f1e5 },
+	{ 0x1f201, 0x1f20f },
+	{ 0x1f21a, 0x1f21a },
+	{ 0x1f22f, 0x1f22f },
+	{ 0x1f232, 0x1f23a },
+	{ 0x1f23c, 0x1f23f },
+	{ 0x1f249, 0x1f3fa },
+	{ 0x1f400, 0x1f53d },
+	{ 0x1f546, 0x1f64f },
+	{ 0x1f680, 0x1f6ff },
+	{ 0x1f774, 0x1f77f },
+	{ 0x1f7d5, 0x1f7ff },
+	{ 0x1f80c, 0x1f80f },
+	{ 0x1f848, 0x1f84f },
+	{ 0x1f85a, 0x1f85f },
+	{ 0x1f888, 0x1f88f },
+	{ 0x1f8ae, 0x1f8ff },
+	{ 0x1f90c, 0x1f93a },
+	{ 0x1f93c, 0x1f945 },
+	{ 0x1f947, 0x1faff },
+	{ 0x1fc00, 0x1fffd },
+};
+
+#define ARRAY_LENGTH(_arr) (sizeof(_arr) / sizeof(*(_arr)))
+
+static void fill(uint8_t *map, const struct range *ranges, size_t num,
+		 uint8_t val)
+{
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < num; ++i)
+		for (j = ranges[i].first; j <= ranges[i].last; ++j)
+			map[j] = val;
+}
+
+/*
+ * Pack @map with @bits bits per code point into deduplicated blocks and
+ * write the first-level index @name_index and the blocks @name_data.
+ */
+static int emit_table(FILE *f, const char *name, const uint8_t *map,
+		      unsigned int bits)
+{
+	unsigned int per_byte = 8 / bits;
+	unsigned int bytes = BLOCK_SIZE / per_byte;
+	uint8_t *data, *blk;
+	unsigned int index[BLOCK_NUM];
+	unsigned int i, j, k, num = 0;
+
+	data = calloc(BLOCK_NUM, bytes);
+	if (!data)
+		return -1;
+
+	for (i = 0; i < BLOCK_NUM; ++i) {
+		blk = &data[num * bytes];
+		memset(blk, 0, bytes);
+		for (j = 0; j < BLOCK_SIZE; ++j)
+			blk[j / per_byte] |= map[i * BLOCK_SIZE + j] <<
+					     ((j % per_byte) * bits);
+
+		for (k = 0; k < num; ++k)
+			if (!memcmp(&data[k * bytes], blk, bytes))
+				break;
+		index[i] = k;
+		if (k == num)
+			++num;
+	}
+
+	if (num > 256) {
+		fprintf(stderr, "%s: too many distinct blocks (%u)\n", name,
+			num);
+		free(data);
+		return -1;
+	}
+
+	fprintf(f, "static const uint8_t %s_index[%u] = {", name, BLOCK_NUM);
+	for (i = 0; i < BLOCK_NUM; ++i)
+		fprintf(f, "%s%u,", i % 16 ? " " : "\n\t", index[i]);
+	fprintf(f, "\n};\n\n");
+
+	fprintf(f, "static const uint8_t %s_data[%u][%u] = {\n", name, num,
+		bytes);
+	for (k = 0; k < num; ++k) {
+		fprintf(f, "\t{");
+		for (j = 0; j < bytes; ++j)
+			fprintf(f, "%s0x%02x,", j % 12 ? " " : "\n\t\t",
+				data[k * bytes + j]);
+		fprintf(f, "\n\t},\n");
+	}
+	fprintf(f, "};\n\n");
+
+	free(data);
+	return 0;
+}
+
+static int emit_class(FILE *f)
+{
+	uint8_t *map;
+	int r;
+
+	map = malloc(UCS4_NUM);
+	if (!map)
+		return -1;
+
+	memset(map, UCLASS_WORD, UCS4_NUM);
+	fill(map, cjk_ranges, ARRAY_LENGTH(cjk_ranges), UCLASS_CJK);
+	fill(map, punct_ranges, ARRAY_LENGTH(punct_ranges), UCLASS_PUNCT);
+	fill(map, space_ranges, ARRAY_LENGTH(space_ranges), UCLASS_SPACE);
+
+	r = emit_table(f, "tsm_uclass", map, 2);
+	free(map);
+	return r;
+}
+
+static int emit_width(FILE *f)
+{
+	uint8_t *map;
+	uint32_t i;
+	int r, w;
+
+	map = malloc(UCS4_NUM);
+	if (!map)
+		return -1;
+
+	for (i = 0; i < UCS4_NUM; ++i) {
+		w = tsm_wcwidth(i);
+		map[i] = w > 0 ? w : 0;
+	}
+
+	r = emit_table(f, "tsm_uwidth", map, 2);
+	free(map);
+	return r;
+}
+
+static int emit_gbp(FILE *f)
+{
+	uint8_t *map;
+	uint32_t i;
+	int r;
+
+	map = malloc(UCS4_NUM);
+	if (!map)
+		return -1;
+
+	memset(map, GBP_OTHER, UCS4_NUM);
+	for (i = 1; i < UCS4_NUM; ++i)
+		if (!tsm_wcwidth(i))
+			map[i] = GBP_EXTEND;
+
+#define FILL(_ranges, _val) fill(map, (_ranges), ARRAY_LENGTH(_ranges), (_val))
+	FILL(gbp_extend_ranges, GBP_EXTEND);
+	FILL(gbp_control_ranges, GBP_CONTROL);
+	FILL(gbp_prepend_ranges, GBP_PREPEND);
+	FILL(gbp_spacingmark_ranges, GBP_SPACINGMARK);
+	FILL(gbp_l_ranges, GBP_L);
+	FILL(gbp_v_ranges, GBP_V);
+	FILL(gbp_t_ranges, GBP_T);
+	FILL(gbp_extpict_ranges, GBP_EXTPICT);
+#undef FILL
+
+	map[0x000a] = GBP_LF;
+	map[0x000d] = GBP_CR;
+	map[0x200d] = GBP_ZWJ;
+	for (i = 0x1f1e6; i <= 0x1f1ff; ++i)
+		map[i] = GBP_RI;
+	for (i = 0xac00; i <= 0xd7a3; ++i)
+		map[i] = (i - 0xac00) % 28 ? GBP_LVT : GBP_LV;
+
+	r = emit_table(f, "tsm_ugbp", map, 4);
+	free(map);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	int r;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <output>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	f = fopen(argv[1], "w");
+	if (!f) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(f, "/* generated by tsm-unicode-gen, do not edit */\n\n");
+	fprintf(f, "#define TSM_UTABLE_SHIFT %u\n\n", BLOCK_SHIFT);
+
+	r = emit_class(f);
+	if (!r)
+		r = emit_width(f);
+	if (!r)
+		r = emit_gbp(f);
+
+	if (fclose(f) || r) {
+		fprintf(stderr, "cannot write %s\n", argv[1]);
+		remove(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
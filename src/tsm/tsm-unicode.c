@@ -58,11 +58,13 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
-#include "wcwidth/wcwidth.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "libtsm.h"
 #include "libtsm-int.h"
 #include "shl-array.h"
-#include "shl-htable.h"
+#include "tsm-unicode-tables.h"
 
 /*
  * Unicode Symbol Handling
@@ -84,69 +86,236 @@
  * a valid UCS4 value, though. But no memory management is needed as all
  * tsm_symbol_t objects are simple integers.
  *
- * The symbol table contains two-way
- * references. The Hash Table contains all the symbols with the symbol ucs4
- * string as key and the symbol ID as value.
- * The index array contains the symbol ID as key and a pointer to the ucs4
- * string as value. But the hash table owns the ucs4 string.
- * This allows fast implementations of *_get() and *_append() without long
- * search intervals.
+ * The symbol table keeps one entry per combined symbol, indexed by the symbol
+ * ID, with the hash, the length and a pointer to the ucs4 string. Strings are
+ * not terminated and live in an arena of fixed-size blocks that never move,
+ * so pointers returned by tsm_symbol_get() stay valid until the symbol is
+ * collected. Freed strings are kept on one free-list per length for reuse.
+ * Lookups by string go through an open-addressing hash table with linear
+ * probing whose slots store the hash next to the entry index, so a probe only
+ * touches the string of an entry if the full hash matches. In front of it, a
+ * small direct-mapped cache remembers the result of recent appends, so text
+ * that repeats the same base and combining mark pairs over and over resolves
+ * them without copying or hashing the string.
  *
  * When creating a new symbol, we simply return the UCS4 value as new symbol. We
  * do not add it to our symbol table as it is only one character. However, if a
  * character is appended to an existing symbol, we create a new ucs4 string and
  * push the new symbol into the symbol table.
+ *
+ * Symbols do not carry reference counts. Instead, the owner of the table
+ * collects them with a mark-and-sweep pass: it calls
+ * tsm_symbol_table_mark_begin(), marks every symbol it still stores and then
+ * calls tsm_symbol_table_sweep(), which frees all unmarked symbols and keeps
+ * their IDs for reuse. As a reused ID may now describe a different string,
+ * every sweep that frees something bumps the table epoch; anyone caching
+ * symbols outside of the marked storage must drop them when it changes.
  */
 
+/* entries to allow before the first collection is due */
+#define TSM_SYMBOL_GC_MIN 1024
+
+/* code points per arena block */
+#define SYMBOL_BLOCK_SIZE 4096
+
+/* initial number of hash slots, must be a power of two */
+#define SYMBOL_SLOTS_MIN 64
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED UINT32_MAX
+
+/* entries of the append cache, must be a power of two */
+#define SYMBOL_CACHE_SIZE 256
+
 const tsm_symbol_t tsm_symbol_default = 0;
 
+struct symbol_block {
+	struct symbol_block *next;
+	size_t used;
+	uint32_t data[SYMBOL_BLOCK_SIZE];
+};
+
+struct symbol {
+	uint32_t *ucs4;			/* string in the arena or NULL */
+	uint32_t hash;
+	uint32_t len;
+};
+
+struct symbol_slot {
+	uint32_t hash;
+	uint32_t idx;			/* entry index or SLOT_* */
+};
+
+struct symbol_cache {
+	tsm_symbol_t sym;
+	uint32_t ucs4;
+	tsm_symbol_t res;		/* sym + ucs4 or 0 if unused */
+};
+
 struct tsm_symbol_table {
 	unsigned long ref;
-	uint32_t next_id;
-	struct shl_array *index;
-	struct shl_htable symbols;
+
+	struct symbol *symbols;		/* entries by ID, the first is unused */
+	uint32_t num;
+	uint32_t size;
+
+	struct symbol_slot *slots;
+	uint32_t mask;			/* number of slots - 1 */
+	uint32_t used;			/* slots not empty, including deleted */
+
+	struct symbol_block *blocks;
+	size_t num_blocks;
+	uint32_t *free_strs[TSM_UCS4_MAXLEN + 1];
+
+	struct symbol_cache cache[SYMBOL_CACHE_SIZE];
+
+	struct shl_array *free_ids;	/* IDs of swept symbols */
+	uint8_t *marks;			/* mark bit per entry */
+	size_t marks_len;
+	size_t entries;			/* symbols in the table */
+	size_t marked;			/* symbols marked since mark_begin */
+	size_t gc_limit;		/* entries that make a collection due */
+	unsigned long epoch;
+	unsigned long collections;
 };
 
-static size_t hash_ucs4(const void *key, void *priv)
+static uint32_t hash_ucs4(const uint32_t *ucs4, size_t len)
 {
-	size_t i, val = 5381;
-	const uint32_t *ucs4 = key;
+	uint32_t val = 2166136261U;
+	size_t i;
 
-	for (i = 0; ucs4[i] <= TSM_UCS4_MAX; ++i)
-		val = val * 33 + ucs4[i];
+	for (i = 0; i < len; ++i)
+		val = (val ^ ucs4[i]) * 16777619U;
 
 	return val;
 }
 
-static bool cmp_ucs4(const void *a, const void *b)
+static uint32_t symbol_find(struct tsm_symbol_table *tbl,
+			    const uint32_t *ucs4, size_t len, uint32_t hash)
 {
-	size_t i;
-	const uint32_t *v1, *v2;
+	struct symbol_slot *slot;
+	struct symbol *sym;
+	uint32_t i;
 
-	v1 = a;
-	v2 = b;
+	if (!tbl->slots)
+		return 0;
 
-	for (i = 0; ; ++i) {
-		if (v1[i] > TSM_UCS4_MAX && v2[i] > TSM_UCS4_MAX)
-			return true;
-		if (v1[i] != v2[i])
-			return false;
+	for (i = hash & tbl->mask; ; i = (i + 1) & tbl->mask) {
+		slot = &tbl->slots[i];
+		if (slot->idx == SLOT_EMPTY)
+			return 0;
+		if (slot->idx == SLOT_DELETED || slot->hash != hash)
+			continue;
+
+		sym = &tbl->symbols[slot->idx];
+		if (sym->len == len &&
+		    !memcmp(sym->ucs4, ucs4, len * sizeof(uint32_t)))
+			return slot->idx;
 	}
 }
 
-static void free_ucs4(void *elem, void *priv)
+static void slot_insert(struct tsm_symbol_table *tbl, uint32_t hash,
+			uint32_t idx)
 {
-	uint32_t *v = elem;
+	struct symbol_slot *slot;
+	uint32_t i;
+
+	for (i = hash & tbl->mask; ; i = (i + 1) & tbl->mask) {
+		slot = &tbl->slots[i];
+		if (slot->idx == SLOT_EMPTY)
+			++tbl->used;
+		else if (slot->idx != SLOT_DELETED)
+			continue;
+
+		slot->hash = hash;
+		slot->idx = idx;
+		return;
+	}
+}
+
+static void slot_remove(struct tsm_symbol_table *tbl, uint32_t hash,
+			uint32_t idx)
+{
+	uint32_t i;
 
-	/* key is prefix with actual value so pass correct pointer */
-	free(--v);
+	for (i = hash & tbl->mask; ; i = (i + 1) & tbl->mask) {
+		if (tbl->slots[i].idx == idx) {
+			tbl->slots[i].idx = SLOT_DELETED;
+			return;
+		}
+	}
+}
+
+/* Make room for one more slot, keeping at most 3/4 of them in use. Deleted
+ * slots are dropped while rehashing. */
+static int slots_reserve(struct tsm_symbol_table *tbl)
+{
+	struct symbol_slot *slots;
+	uint32_t size, i;
+
+	if (tbl->slots && (tbl->used + 1) * 4ULL <= (tbl->mask + 1) * 3ULL)
+		return 0;
+
+	size = SYMBOL_SLOTS_MIN;
+	while (size < (tbl->entries + 1) * 2)
+		size *= 2;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+
+	free(tbl->slots);
+	tbl->slots = slots;
+	tbl->mask = size - 1;
+	tbl->used = 0;
+
+	for (i = 1; i < tbl->num; ++i) {
+		if (tbl->symbols[i].ucs4)
+			slot_insert(tbl, tbl->symbols[i].hash, i);
+	}
+
+	return 0;
+}
+
+/* Combined symbols have at least two code points, so a free string can hold
+ * the free-list pointer. */
+static uint32_t *str_alloc(struct tsm_symbol_table *tbl, size_t len)
+{
+	struct symbol_block *block;
+	uint32_t *str;
+
+	str = tbl->free_strs[len];
+	if (str) {
+		memcpy(&tbl->free_strs[len], str, sizeof(str));
+		return str;
+	}
+
+	block = tbl->blocks;
+	if (!block || block->used + len > SYMBOL_BLOCK_SIZE) {
+		block = malloc(sizeof(*block));
+		if (!block)
+			return NULL;
+		block->used = 0;
+		block->next = tbl->blocks;
+		tbl->blocks = block;
+		++tbl->num_blocks;
+	}
+
+	str = &block->data[block->used];
+	block->used += len;
+	return str;
+}
+
+static void str_free(struct tsm_symbol_table *tbl, uint32_t *str, size_t len)
+{
+	memcpy(str, &tbl->free_strs[len], sizeof(str));
+	tbl->free_strs[len] = str;
 }
 
 int tsm_symbol_table_new(struct tsm_symbol_table **out)
 {
 	struct tsm_symbol_table *tbl;
 	int ret;
-	static const uint32_t *val = NULL; /* we need a valid lvalue */
 
 	if (!out)
 		return -EINVAL;
@@ -156,19 +325,26 @@ int tsm_symbol_table_new(struct tsm_symbol_table **out)
 		return -ENOMEM;
 	memset(tbl, 0, sizeof(*tbl));
 	tbl->ref = 1;
-	tbl->next_id = TSM_UCS4_MAX + 2;
-	shl_htable_init(&tbl->symbols, cmp_ucs4, hash_ucs4, NULL);
+	tbl->gc_limit = TSM_SYMBOL_GC_MIN;
 
-	ret = shl_array_new(&tbl->index, sizeof(uint32_t*), 4);
+	ret = shl_array_new(&tbl->free_ids, sizeof(uint32_t), 4);
 	if (ret)
 		goto err_free;
 
 	/* first entry is not used so add dummy */
-	shl_array_push(tbl->index, &val);
+	tbl->size = 16;
+	tbl->symbols = calloc(tbl->size, sizeof(*tbl->symbols));
+	if (!tbl->symbols) {
+		ret = -ENOMEM;
+		goto err_ids;
+	}
+	tbl->num = 1;
 
 	*out = tbl;
 	return 0;
 
+err_ids:
+	shl_array_free(tbl->free_ids);
 err_free:
 	free(tbl);
 	return ret;
@@ -184,14 +360,136 @@ void tsm_symbol_table_ref(struct tsm_symbol_table *tbl)
 
 void tsm_symbol_table_unref(struct tsm_symbol_table *tbl)
 {
+	struct symbol_block *block;
+
 	if (!tbl || !tbl->ref || --tbl->ref)
 		return;
 
-	shl_htable_clear(&tbl->symbols, free_ucs4, NULL);
-	shl_array_free(tbl->index);
+	while ((block = tbl->blocks)) {
+		tbl->blocks = block->next;
+		free(block);
+	}
+
+	shl_array_free(tbl->free_ids);
+	free(tbl->symbols);
+	free(tbl->slots);
+	free(tbl->marks);
 	free(tbl);
 }
 
+bool tsm_symbol_table_gc_due(struct tsm_symbol_table *tbl)
+{
+	return tbl && tbl->entries >= tbl->gc_limit;
+}
+
+unsigned long tsm_symbol_table_get_epoch(struct tsm_symbol_table *tbl)
+{
+	return tbl ? tbl->epoch : 0;
+}
+
+int tsm_symbol_table_mark_begin(struct tsm_symbol_table *tbl)
+{
+	size_t len;
+	uint8_t *tmp;
+
+	if (!tbl)
+		return -EINVAL;
+
+	len = (tbl->num + 7) / 8;
+	if (len > tbl->marks_len) {
+		tmp = realloc(tbl->marks, len);
+		if (!tmp)
+			return -ENOMEM;
+		tbl->marks = tmp;
+		tbl->marks_len = len;
+	}
+
+	memset(tbl->marks, 0, tbl->marks_len);
+	tbl->marked = 0;
+	return 0;
+}
+
+void tsm_symbol_table_mark(struct tsm_symbol_table *tbl, tsm_symbol_t sym)
+{
+	uint32_t idx;
+
+	if (sym <= TSM_UCS4_MAX)
+		return;
+
+	idx = sym - (TSM_UCS4_MAX + 1);
+	if (idx / 8 >= tbl->marks_len || tbl->marks[idx / 8] & (1 << idx % 8))
+		return;
+
+	tbl->marks[idx / 8] |= 1 << idx % 8;
+	++tbl->marked;
+}
+
+/*
+ * Free all symbols that were not marked since the last call to
+ * tsm_symbol_table_mark_begin() and return how many were freed. No symbols
+ * must be created between the two calls.
+ */
+unsigned int tsm_symbol_table_sweep(struct tsm_symbol_table *tbl)
+{
+	struct symbol *sym;
+	uint32_t i, len;
+	unsigned int freed = 0;
+
+	if (!tbl)
+		return 0;
+
+	len = tbl->num;
+	if (len > tbl->marks_len * 8)
+		len = tbl->marks_len * 8;
+
+	for (i = 1; i < len; ++i) {
+		sym = &tbl->symbols[i];
+		if (!sym->ucs4 || tbl->marks[i / 8] & (1 << i % 8))
+			continue;
+
+		if (shl_array_push(tbl->free_ids, &i))
+			break;
+
+		slot_remove(tbl, sym->hash, i);
+		str_free(tbl, sym->ucs4, sym->len);
+		sym->ucs4 = NULL;
+		--tbl->entries;
+		++freed;
+	}
+
+	/* cached results may refer to freed IDs */
+	if (freed) {
+		memset(tbl->cache, 0, sizeof(tbl->cache));
+		++tbl->epoch;
+	}
+	++tbl->collections;
+
+	tbl->gc_limit = tbl->entries * 2;
+	if (tbl->gc_limit < TSM_SYMBOL_GC_MIN)
+		tbl->gc_limit = TSM_SYMBOL_GC_MIN;
+
+	return freed;
+}
+
+void tsm_symbol_table_get_stats(struct tsm_symbol_table *tbl,
+				struct tsm_symbol_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!tbl)
+		return;
+
+	stats->entries = tbl->entries;
+	stats->marked = tbl->marked;
+	stats->free_ids = shl_array_get_length(tbl->free_ids);
+	stats->bytes = sizeof(*tbl) + tbl->marks_len +
+		       tbl->num_blocks * sizeof(struct symbol_block) +
+		       tbl->size * sizeof(*tbl->symbols) +
+		       shl_array_get_bsize(tbl->free_ids);
+	if (tbl->slots)
+		stats->bytes += (tbl->mask + 1) * sizeof(*tbl->slots);
+	stats->collections = tbl->collections;
+}
+
 tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
 {
 	if (ucs4 > TSM_UCS4_MAX)
@@ -206,7 +504,8 @@ tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
  * Therefore, the returned value may get destroyed if your \sym argument gets
  * destroyed.
  * If \sym is a composed ucs4 string, then the returned value points into the
- * hash table of the symbol table and lives as long as the symbol table does.
+ * arena of the symbol table and lives until the symbol is collected. It is not
+ * terminated.
  *
  * This always returns a valid value. If an error happens, the default character
  * is returned. If \size is NULL, then the size value is omitted.
@@ -214,7 +513,8 @@ tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
 const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t *sym, size_t *size)
 {
-	uint32_t *ucs4, idx;
+	struct symbol *entry;
+	uint32_t idx;
 
 	if (*sym <= TSM_UCS4_MAX) {
 		if (size)
@@ -226,34 +526,27 @@ const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 		return sym;
 
 	idx = *sym - (TSM_UCS4_MAX + 1);
-	if (idx >= shl_array_get_length(tbl->index))
-		ucs4 = NULL;
-	else
-		ucs4 = *SHL_ARRAY_AT(tbl->index, uint32_t*, idx);
-
-	if (!ucs4) {
+	if (idx >= tbl->num || !tbl->symbols[idx].ucs4) {
 		if (size)
 			*size = 1;
 		return &tsm_symbol_default;
 	}
 
-	if (size) {
-		*size = 0;
-		while (ucs4[*size] <= TSM_UCS4_MAX)
-			++*size;
-	}
+	entry = &tbl->symbols[idx];
+	if (size)
+		*size = entry->len;
 
-	return ucs4;
+	return entry->ucs4;
 }
 
 tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4)
 {
-	uint32_t buf[TSM_UCS4_MAXLEN + 1], nsym, *nval;
+	uint32_t buf[TSM_UCS4_MAXLEN], hash, idx, *str;
+	struct symbol_cache *cache;
+	struct symbol *entry;
 	const uint32_t *ptr;
 	size_t s;
-	bool res;
-	int ret;
 
 	if (!tbl)
 		return sym;
@@ -261,55 +554,70 @@ tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 	if (ucs4 > TSM_UCS4_MAX)
 		return sym;
 
+	cache = &tbl->cache[(sym * 31 + ucs4) & (SYMBOL_CACHE_SIZE - 1)];
+	if (cache->res && cache->sym == sym && cache->ucs4 == ucs4)
+		return cache->res;
+
 	ptr = tsm_symbol_get(tbl, &sym, &s);
 	if (s >= TSM_UCS4_MAXLEN)
 		return sym;
 
 	memcpy(buf, ptr, s * sizeof(uint32_t));
 	buf[s++] = ucs4;
-	buf[s++] = TSM_UCS4_MAX + 1;
 
-	res = shl_htable_lookup(&tbl->symbols, buf, hash_ucs4(buf, NULL),
-				(void**)&nval);
-	if (res) {
-		/* key is prefixed with actual value */
-		return *--nval;
-	}
+	hash = hash_ucs4(buf, s);
+	idx = symbol_find(tbl, buf, s, hash);
+	if (idx)
+		goto out;
 
-	/* We save the key in nval and prefix it with the new ID. Note that
-	 * the prefix is hidden, we actually store "++nval" in the htable. */
-	nval = malloc(sizeof(uint32_t) * (s + 1));
-	if (!nval)
+	if (slots_reserve(tbl))
 		return sym;
 
-	++nval;
-	memcpy(nval, buf, s * sizeof(uint32_t));
-
-	nsym = tbl->next_id + 1;
-	/* Out of IDs; we actually have 2 Billion IDs so this seems
-	 * very unlikely but lets be safe here */
-	if (nsym <= tbl->next_id++)
-		goto err_id;
-
-	/* store ID hidden before the key */
-	*(nval - 1) = nsym;
-
-	ret = shl_htable_insert(&tbl->symbols, nval, hash_ucs4(nval, NULL));
-	if (ret)
-		goto err_id;
+	/* reuse the ID of a swept symbol if there is one */
+	if (shl_array_get_length(tbl->free_ids)) {
+		idx = *SHL_ARRAY_AT(tbl->free_ids, uint32_t,
+				    shl_array_get_length(tbl->free_ids) - 1);
+	} else {
+		/* Out of IDs; we actually have 2 Billion IDs so this seems
+		 * very unlikely but lets be safe here */
+		if (tbl->num >= UINT32_MAX - TSM_UCS4_MAX)
+			return sym;
+
+		if (tbl->num >= tbl->size) {
+			entry = realloc(tbl->symbols,
+					sizeof(*entry) * tbl->size * 2);
+			if (!entry)
+				return sym;
+			tbl->symbols = entry;
+			tbl->size *= 2;
+		}
 
-	ret = shl_array_push(tbl->index, &nval);
-	if (ret)
-		goto err_symbol;
+		idx = tbl->num;
+	}
 
-	return nsym;
+	str = str_alloc(tbl, s);
+	if (!str)
+		return sym;
 
-err_symbol:
-	shl_htable_remove(&tbl->symbols, nval, hash_ucs4(nval, NULL), NULL);
-err_id:
-	--tbl->next_id;
-	free(nval);
-	return sym;
+	if (idx == tbl->num)
+		++tbl->num;
+	else
+		shl_array_pop(tbl->free_ids);
+
+	memcpy(str, buf, s * sizeof(uint32_t));
+	entry = &tbl->symbols[idx];
+	entry->ucs4 = str;
+	entry->hash = hash;
+	entry->len = s;
+	slot_insert(tbl, hash, idx);
+	++tbl->entries;
+
+out:
+	/* IDs map to their position in the entries, see tsm_symbol_get() */
+	cache->sym = sym;
+	cache->ucs4 = ucs4;
+	cache->res = idx + TSM_UCS4_MAX + 1;
+	return cache->res;
 }
 
 unsigned int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
@@ -328,16 +636,62 @@ unsigned int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
 	return tsm_ucs4_get_width(*ch);
 }
 
+/* Look up @ucs4 in a generated table with 2 bits per code point. */
+static inline unsigned int utable_get(const uint8_t *index,
+				      const uint8_t (*data)[64], uint32_t ucs4)
+{
+	const uint8_t *blk;
+
+	blk = data[index[ucs4 >> TSM_UTABLE_SHIFT]];
+	ucs4 &= (1 << TSM_UTABLE_SHIFT) - 1;
+	return (blk[ucs4 >> 2] >> ((ucs4 & 3) * 2)) & 3;
+}
+
+/*
+ * Display widths are looked up in the tables generated from tsm_wcwidth() by
+ * tsm-unicode-gen.c. Code points below U+0300 have no combining or wide
+ * characters and are handled without touching the tables. Values beyond
+ * U+10FFFF are not in any table and are reported as narrow, like
+ * tsm_wcwidth() does.
+ */
 SHL_EXPORT
 unsigned int tsm_ucs4_get_width(uint32_t ucs4)
 {
-	int ret;
+	if (ucs4 < 0x300)
+		return ucs4 >= 0x20 && (ucs4 < 0x7f || ucs4 >= 0xa0);
+	if (ucs4 > 0x10ffff)
+		return 1;
 
-	ret = tsm_wcwidth(ucs4);
-	if (ret <= 0)
-		return 0;
+	return utable_get(tsm_uwidth_index, tsm_uwidth_data, ucs4);
+}
 
-	return ret;
+/*
+ * Character class of a single code point as used for word selection. This is
+ * a lookup in the tables generated by tsm-unicode-gen.c, invalid code points
+ * are treated as spaces.
+ */
+unsigned int tsm_ucs4_get_class(uint32_t ucs4)
+{
+	if (ucs4 > 0x10ffff)
+		return TSM_UCLASS_SPACE;
+
+	return utable_get(tsm_uclass_index, tsm_uclass_data, ucs4);
+}
+
+/*
+ * Grapheme break property of a single code point, used by the VTE to segment
+ * printed text into grapheme clusters.
+ */
+unsigned int tsm_ucs4_get_gbp(uint32_t ucs4)
+{
+	const uint8_t *blk;
+
+	if (ucs4 > 0x10ffff)
+		return TSM_GBP_OTHER;
+
+	blk = tsm_ugbp_data[tsm_ugbp_index[ucs4 >> TSM_UTABLE_SHIFT]];
+	ucs4 &= (1 << TSM_UTABLE_SHIFT) - 1;
+	return (blk[ucs4 >> 1] >> ((ucs4 & 1) * 4)) & 15;
 }
 
 /*
@@ -415,24 +769,147 @@ size_t tsm_ucs4_to_utf8(uint32_t g, char *txt)
 	}
 }
 
+/*
+ * Bulk UTF-8 Encoding
+ * Terminal text is mostly ASCII or, for many scripts, mostly 2-byte
+ * sequences. With SSE2, blocks of 8 code points that are all ASCII or all
+ * 2-byte are encoded with a few vector operations and all other blocks fall
+ * back to tsm_ucs4_to_utf8(). The output is always identical to encoding each
+ * code point on its own, including dropping invalid code points.
+ */
+
+#ifdef __SSE2__
+
+/* Sum up the UTF-8 length of leading code points below U+D800, which are all
+ * valid, and store how many were covered in @done. */
+static size_t utf8_len_block(const uint32_t *ucs4, size_t len, size_t *done)
+{
+	__m128i v, acc, c7f, c7ff, cd800;
+	uint32_t sum[4];
+	size_t i, n;
+
+	acc = _mm_setzero_si128();
+	c7f = _mm_set1_epi32(0x7f);
+	c7ff = _mm_set1_epi32(0x7ff);
+	cd800 = _mm_set1_epi32(0xd800 >> 11);
+
+	/* the lane counters grow by at most 2 per block, flush in time */
+	if (len > (1U << 28))
+		len = 1U << 28;
+
+	n = 0;
+	for (i = 0; i + 4 <= len; i += 4) {
+		v = _mm_loadu_si128((const __m128i*)&ucs4[i]);
+		if (_mm_movemask_epi8(_mm_cmplt_epi32(_mm_srli_epi32(v, 11),
+						      cd800)) != 0xffff)
+			break;
+
+		acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, c7f));
+		acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, c7ff));
+		n += 4;
+	}
+
+	_mm_storeu_si128((__m128i*)sum, acc);
+	*done = i;
+	return n + sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+/* Encode 8 code points if they are all ASCII or all 2-byte sequences and
+ * return the number of bytes written, 0 otherwise. */
+static size_t utf8_encode_block(const uint32_t *ucs4, char *out)
+{
+	__m128i a, b, lo, hi, zero;
+
+	zero = _mm_setzero_si128();
+	a = _mm_loadu_si128((const __m128i*)&ucs4[0]);
+	b = _mm_loadu_si128((const __m128i*)&ucs4[4]);
+
+	hi = _mm_srli_epi32(_mm_or_si128(a, b), 7);
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(hi, zero)) == 0xffff) {
+		a = _mm_packs_epi32(a, b);
+		_mm_storel_epi64((__m128i*)out, _mm_packus_epi16(a, a));
+		return 8;
+	}
+
+	hi = _mm_srli_epi32(_mm_or_si128(a, b), 11);
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(hi, zero)) != 0xffff ||
+	    _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(a, 7), zero)) ||
+	    _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(b, 7), zero)))
+		return 0;
+
+	/* lead byte 0xc0 | c >> 6, then 0x80 | (c & 0x3f), as little-endian
+	 * 16-bit words, biased so the signed saturation of packs keeps them */
+	lo = _mm_set1_epi32(0x3f);
+	hi = _mm_set1_epi32(0x80c0 - 0x8000);
+	a = _mm_add_epi32(_mm_or_si128(_mm_srli_epi32(a, 6),
+				       _mm_slli_epi32(_mm_and_si128(a, lo), 8)),
+			  hi);
+	b = _mm_add_epi32(_mm_or_si128(_mm_srli_epi32(b, 6),
+				       _mm_slli_epi32(_mm_and_si128(b, lo), 8)),
+			  hi);
+	a = _mm_xor_si128(_mm_packs_epi32(a, b), _mm_set1_epi16(-0x8000));
+	_mm_storeu_si128((__m128i*)out, a);
+	return 16;
+}
+
+#endif
+
+SHL_EXPORT
+size_t tsm_ucs4_to_utf8_bulk(const uint32_t *ucs4, size_t len, char *out)
+{
+	size_t i, pos, n;
+
+	i = 0;
+	pos = 0;
+
+	if (!out) {
+		while (i < len) {
+#ifdef __SSE2__
+			pos += utf8_len_block(&ucs4[i], len - i, &n);
+			i += n;
+#endif
+			if (i < len)
+				pos += tsm_ucs4_get_len(ucs4[i++]);
+		}
+
+		return pos;
+	}
+
+#ifdef __SSE2__
+	while (i + 8 <= len) {
+		n = utf8_encode_block(&ucs4[i], &out[pos]);
+		if (n) {
+			pos += n;
+			i += 8;
+			continue;
+		}
+
+		for (n = i + 8; i < n; ++i)
+			pos += tsm_ucs4_to_utf8(ucs4[i], &out[pos]);
+	}
+#endif
+
+	for ( ; i < len; ++i)
+		pos += tsm_ucs4_to_utf8(ucs4[i], &out[pos]);
+
+	return pos;
+}
+
 SHL_EXPORT
 char *tsm_ucs4_to_utf8_alloc(const uint32_t *ucs4, size_t len, size_t *len_out)
 {
 	char *val;
-	size_t i, pos;
+	size_t pos;
 
-	val = malloc(4 * len);
-	if (!val)
+	pos = tsm_ucs4_to_utf8_bulk(ucs4, len, NULL);
+	if (!pos)
 		return NULL;
 
-	pos = 0;
-	for (i = 0; i < len; ++i)
-		pos += tsm_ucs4_to_utf8(ucs4[i], &val[pos]);
-
-	if (!pos) {
-		free(val);
+	val = malloc(pos);
+	if (!val)
 		return NULL;
-	}
+
+	tsm_ucs4_to_utf8_bulk(ucs4, len, val);
 
 	if (len_out)
 		*len_out = pos;
@@ -184,6 +184,11 @@ struct tsm_vte {
 	struct tsm_screen_attr def_attr;
 	struct tsm_screen_attr cattr;
 	unsigned int flags;
+	tsm_symbol_t last_sym;		/* last printed symbol for REP */
+	uint32_t gb_last;		/* last printed code point or 0 */
+	unsigned int gb_prop;		/* grapheme break property of gb_last */
+	bool gb_pict;			/* cluster is ExtPict Extend* ZWJ? */
+	bool gb_ri_odd;			/* odd number of regional indicators */
 
 	tsm_vte_charset **gl;
 	tsm_vte_charset **gr;
@@ -653,6 +658,114 @@ static void write_console(struct tsm_vte *vte, tsm_symbol_t sym)
 {
 	to_rgb(vte, &vte->cattr);
 	tsm_screen_write(vte->con, sym, &vte->cattr);
+	vte->last_sym = sym;
+}
+
+/*
+ * Grapheme Clusters
+ * Printed code points are segmented into extended grapheme clusters following
+ * UAX #29, with break properties from the generated table. A code point that
+ * continues the current cluster and has no width of its own is appended to
+ * the symbol of the previous cell, so combining marks, ZWJ and variation
+ * selectors stay with their base character. Continuations that have a width,
+ * like the second half of a flag, still get their own cells so the cursor
+ * keeps moving like wcwidth()-based applications expect.
+ * No rule joins two code points below U+0300, so for such text the only cost
+ * is one comparison. The break property of such a code point is looked up
+ * lazily once a code point above that limit follows it.
+ * Anything but printing ends the current cluster.
+ */
+
+static void grapheme_reset(struct tsm_vte *vte)
+{
+	vte->gb_last = 0;
+	vte->gb_prop = TSM_GBP_NONE;
+	vte->gb_pict = false;
+	vte->gb_ri_odd = false;
+}
+
+static bool grapheme_continues(struct tsm_vte *vte, unsigned int prop)
+{
+	unsigned int prev = vte->gb_prop;
+
+	/* GB1, GB4, GB5 */
+	if (prev == TSM_GBP_NONE || prev == TSM_GBP_CR ||
+	    prev == TSM_GBP_LF || prev == TSM_GBP_CONTROL)
+		return false;
+	if (prop == TSM_GBP_CR || prop == TSM_GBP_LF ||
+	    prop == TSM_GBP_CONTROL)
+		return false;
+
+	/* GB9, GB9a, GB9b */
+	if (prop == TSM_GBP_EXTEND || prop == TSM_GBP_ZWJ ||
+	    prop == TSM_GBP_SPACINGMARK || prev == TSM_GBP_PREPEND)
+		return true;
+
+	switch (prev) {
+	case TSM_GBP_L:
+		/* GB6 */
+		return prop == TSM_GBP_L || prop == TSM_GBP_V ||
+		       prop == TSM_GBP_LV || prop == TSM_GBP_LVT;
+	case TSM_GBP_LV:
+	case TSM_GBP_V:
+		/* GB7 */
+		return prop == TSM_GBP_V || prop == TSM_GBP_T;
+	case TSM_GBP_LVT:
+	case TSM_GBP_T:
+		/* GB8 */
+		return prop == TSM_GBP_T;
+	case TSM_GBP_ZWJ:
+		/* GB11 */
+		return vte->gb_pict && prop == TSM_GBP_EXTPICT;
+	case TSM_GBP_RI:
+		/* GB12, GB13 */
+		return vte->gb_ri_odd && prop == TSM_GBP_RI;
+	}
+
+	/* GB999 */
+	return false;
+}
+
+static void print_char(struct tsm_vte *vte, uint32_t ucs4)
+{
+	unsigned int prop;
+	bool cont;
+
+	if (ucs4 < 0x300 && vte->gb_last < 0x300) {
+		vte->gb_last = ucs4;
+		write_console(vte, tsm_symbol_make(ucs4));
+		return;
+	}
+
+	if (vte->gb_last && vte->gb_last < 0x300) {
+		vte->gb_prop = tsm_ucs4_get_gbp(vte->gb_last);
+		vte->gb_pict = vte->gb_prop == TSM_GBP_EXTPICT;
+		vte->gb_ri_odd = false;
+	}
+
+	prop = tsm_ucs4_get_gbp(ucs4);
+	cont = grapheme_continues(vte, prop);
+
+	vte->gb_ri_odd = prop == TSM_GBP_RI &&
+			 !(vte->gb_prop == TSM_GBP_RI && vte->gb_ri_odd);
+	if (prop == TSM_GBP_EXTPICT)
+		vte->gb_pict = true;
+	else if (prop != TSM_GBP_EXTEND && prop != TSM_GBP_ZWJ)
+		vte->gb_pict = false;
+	vte->gb_prop = prop;
+	vte->gb_last = ucs4;
+
+	/*
+	 * Only zero-width code points join the previous cell. A wide character
+	 * that continues a cluster, like the emoji after a ZWJ (GB11) or the
+	 * second regional indicator of a flag (GB12, GB13), keeps its own cells
+	 * so we agree with wcwidth() based applications on the cursor position.
+	 * Those rules are only evaluated to keep the gb_* state right.
+	 */
+	if (cont && !tsm_ucs4_get_width(ucs4))
+		screen_append(vte->con, ucs4);
+	else
+		write_console(vte, tsm_symbol_make(ucs4));
 }
 
 static void reset_state(struct tsm_vte *vte)
@@ -726,6 +839,8 @@ void tsm_vte_reset(struct tsm_vte *vte)
 		return;
 
 	vte->flags = 0;
+	vte->last_sym = 0;
+	grapheme_reset(vte);
 	vte->flags |= FLAG_TEXT_CURSOR_MODE;
 	vte->flags |= FLAG_AUTO_REPEAT_MODE;
 	vte->flags |= FLAG_SEND_RECEIVE_MODE;
@@ -1769,6 +1884,18 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 			num = 1;
 		tsm_screen_erase_chars(vte->con, num);
 		break;
+	case 'b': /* REP */
+		/* repeat the preceding graphic character */
+		if (!vte->last_sym)
+			break;
+		num = vte->csi_argv[0];
+		if (num <= 0)
+			num = 1;
+		else if (num > 65535)
+			num = 65535;
+		while (num--)
+			write_console(vte, vte->last_sym);
+		break;
 	case 'm':
 		if (vte->csi_flags & CSI_GT) {
 			/* xterm: set/reset key modifier options (XTMODKEYS) */
@@ -1946,7 +2073,9 @@ static void do_osc_end(struct tsm_vte *vte) {
 /* perform parser action */
 static void do_action(struct tsm_vte *vte, uint32_t data, int action)
 {
-	tsm_symbol_t sym;
+	if (action != ACTION_NONE && action != ACTION_IGNORE &&
+	    action != ACTION_PRINT)
+		grapheme_reset(vte);
 
 	switch (action) {
 		case ACTION_NONE:
@@ -1956,8 +2085,7 @@ static void do_action(struct tsm_vte *vte, uint32_t data, int action)
 			/* ignore character */
 			break;
 		case ACTION_PRINT:
-			sym = tsm_symbol_make(vte_map(vte, data));
-			write_console(vte, sym);
+			print_char(vte, vte_map(vte, data));
 			break;
 		case ACTION_EXECUTE:
 			do_execute(vte, data);
@@ -0,0 +1,200 @@
+/*
+ * TSM - Concurrent Hashtable Benchmarks
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "shl-chtable.h"
+
+/*
+ * Concurrent Hashtable Benchmarks
+ * Reader threads look up a stable key set and a churned key set while a
+ * writer keeps inserting and removing churn nodes, forcing resizes. The
+ * reported rate is the sum over all readers. test_chtable runs the same
+ * workload at a smaller scale to check correctness; this is not registered
+ * with ctest as it takes too long under valgrind.
+ */
+
+#define NODE_ALIVE 0x600dcafeUL
+
+struct node {
+	unsigned long key;
+	unsigned long magic;
+};
+
+static bool node_compare(const void *a, const void *b)
+{
+	return *(const unsigned long*)a == *(const unsigned long*)b;
+}
+
+#define STRESS_STABLE 4096
+#define STRESS_CHURN 4096
+#define STRESS_LOOKUPS 100000
+
+struct stress {
+	struct shl_chtable *t;
+	struct node stable[STRESS_STABLE];
+	unsigned long done;
+};
+
+static double stress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *stress_reader(void *arg)
+{
+	struct stress *s = arg;
+	struct node *n;
+	unsigned long key, seed = (unsigned long)pthread_self();
+	unsigned int i, c;
+	bool b;
+
+	for (i = 0; i < STRESS_LOOKUPS; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 33) % (STRESS_STABLE + STRESS_CHURN);
+
+		c = shl_chtable_read_lock(s->t);
+		b = shl_chtable_lookup(s->t, &key, key, (void**)&n);
+		if (key < STRESS_STABLE)
+			ck_assert(b && n == &s->stable[key]);
+		if (b)
+			ck_assert(n->key == key && n->magic == NODE_ALIVE);
+		shl_chtable_read_unlock(s->t, c);
+	}
+
+	return NULL;
+}
+
+static void *stress_writer(void *arg)
+{
+	struct stress *s = arg;
+	struct node *n, *old;
+	unsigned long key, i = 0;
+	int r;
+
+	while (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+		key = STRESS_STABLE + i++ % STRESS_CHURN;
+
+		n = malloc(sizeof(*n));
+		ck_assert(n != NULL);
+		n->key = key;
+		n->magic = NODE_ALIVE;
+
+		r = shl_chtable_insert(s->t, n, key, NULL);
+		if (r == -EALREADY) {
+			free(n);
+			ck_assert(shl_chtable_remove(s->t, &key, key,
+						     (void**)&old));
+			shl_chtable_synchronize(s->t);
+			old->magic = 0;
+			free(old);
+		} else {
+			ck_assert_int_eq(r, 0);
+		}
+	}
+
+	return NULL;
+}
+
+static void node_free_cb(void *elem, void *ctx)
+{
+	struct node *n = elem;
+
+	if (n->key >= STRESS_STABLE)
+		free(n);
+}
+
+static void stress_run(struct stress *s, unsigned int nreaders)
+{
+	pthread_t readers[nreaders], writer;
+	unsigned int i;
+	double start;
+	int r;
+
+	s->done = 0;
+	r = pthread_create(&writer, NULL, stress_writer, s);
+	ck_assert_int_eq(r, 0);
+
+	start = stress_now();
+	for (i = 0; i < nreaders; ++i) {
+		r = pthread_create(&readers[i], NULL, stress_reader, s);
+		ck_assert_int_eq(r, 0);
+	}
+	for (i = 0; i < nreaders; ++i)
+		pthread_join(readers[i], NULL);
+
+	fprintf(stderr, "chtable lookup %2u readers: %7.1f Mops/s\n",
+		nreaders, STRESS_LOOKUPS * nreaders * 1e3 /
+		(stress_now() - start));
+
+	__atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+}
+
+START_TEST(test_chtable_bench)
+{
+	struct stress *s;
+	unsigned long i;
+	int r;
+
+	s = calloc(1, sizeof(*s));
+	ck_assert(s != NULL);
+
+	r = shl_chtable_new(&s->t, node_compare);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < STRESS_STABLE; ++i) {
+		s->stable[i].key = i;
+		s->stable[i].magic = NODE_ALIVE;
+		r = shl_chtable_insert(s->t, &s->stable[i], i, NULL);
+		ck_assert_int_eq(r, 0);
+	}
+
+	stress_run(s, 1);
+	stress_run(s, 4);
+	stress_run(s, 16);
+
+	shl_chtable_synchronize(s->t);
+	shl_chtable_free(s->t, node_free_cb, NULL);
+	free(s);
+}
+END_TEST
+
+TEST_DEFINE_CASE(bench)
+	TEST(test_chtable_bench)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(chtable_bench,
+		TEST_CASE(bench),
+		TEST_END
+	)
+)
@@ -0,0 +1,174 @@
+/*
+ * TSM - Hashtable Benchmarks
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "shl-htable.h"
+
+/*
+ * Hashtable Benchmarks
+ * These report insert and lookup throughput at sizes of a glyph cache and of
+ * a large table. Build with and without ENABLE_SWISS_HTABLE to compare the
+ * backends. They also verify every result, so they double as stress tests.
+ * They take too long under valgrind, so they are not registered with ctest;
+ * run bench_htable from the build directory instead.
+ */
+
+struct bench_node {
+	unsigned long ul;
+	char *key;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* visit entries in a scattered order like a cache does, not in the order
+ * they were inserted */
+static size_t bench_index(size_t i, size_t size)
+{
+	return (i * 2654435761UL) % size;
+}
+
+static void bench_report(const char *what, size_t size, size_t ops,
+			 double start)
+{
+	fprintf(stderr, "htable %-14s %7zu entries: %6.1f ns/op\n", what, size,
+		(bench_now() - start) / ops);
+}
+
+static void bench_ulong(size_t size)
+{
+	struct shl_htable t = SHL_HTABLE_INIT_ULONG(t);
+	struct bench_node *nodes;
+	unsigned long *k;
+	size_t i, j, rounds;
+	double start;
+	bool b;
+	int r;
+
+	nodes = calloc(size, sizeof(*nodes));
+	ck_assert(nodes != NULL);
+	for (i = 0; i < size; ++i)
+		nodes[i].ul = i * 7;
+
+	start = bench_now();
+	for (i = 0; i < size; ++i) {
+		r = shl_htable_insert_ulong(&t, &nodes[i].ul);
+		ck_assert(!r);
+	}
+	bench_report("ulong insert", size, size, start);
+
+	rounds = 200000 / size + 1;
+	start = bench_now();
+	for (i = 0; i < size * rounds; ++i) {
+		j = bench_index(i, size);
+		b = shl_htable_lookup_ulong(&t, j * 7, &k);
+		ck_assert(b && k == &nodes[j].ul);
+		/* misses */
+		b = shl_htable_lookup_ulong(&t, j * 7 + 1, &k);
+		ck_assert(!b);
+	}
+	bench_report("ulong lookup", size, size * rounds * 2, start);
+
+	/* remove every other entry and check the rest is still found */
+	for (i = 0; i < size; i += 2) {
+		b = shl_htable_remove_ulong(&t, nodes[i].ul, &k);
+		ck_assert(b && k == &nodes[i].ul);
+	}
+	for (i = 0; i < size; ++i) {
+		b = shl_htable_lookup_ulong(&t, nodes[i].ul, &k);
+		ck_assert(b == (i % 2 == 1));
+	}
+
+	shl_htable_clear_ulong(&t, NULL, NULL);
+	free(nodes);
+}
+
+static void bench_str(size_t size)
+{
+	struct shl_htable t = SHL_HTABLE_INIT_STR(t);
+	struct bench_node *nodes;
+	char **k, buf[32];
+	size_t i, j, rounds;
+	double start;
+	bool b;
+	int r;
+
+	nodes = calloc(size, sizeof(*nodes));
+	ck_assert(nodes != NULL);
+	for (i = 0; i < size; ++i) {
+		snprintf(buf, sizeof(buf), "glyph-%zu", i);
+		nodes[i].key = strdup(buf);
+		ck_assert(nodes[i].key != NULL);
+	}
+
+	start = bench_now();
+	for (i = 0; i < size; ++i) {
+		r = shl_htable_insert_str(&t, &nodes[i].key, NULL);
+		ck_assert(!r);
+	}
+	bench_report("str insert", size, size, start);
+
+	rounds = 200000 / size + 1;
+	start = bench_now();
+	for (i = 0; i < size * rounds; ++i) {
+		j = bench_index(i, size);
+		b = shl_htable_lookup_str(&t, nodes[j].key, NULL, &k);
+		ck_assert(b && k == &nodes[j].key);
+	}
+	bench_report("str lookup", size, size * rounds, start);
+
+	shl_htable_clear_str(&t, NULL, NULL);
+	for (i = 0; i < size; ++i)
+		free(nodes[i].key);
+	free(nodes);
+}
+
+START_TEST(test_htable_bench)
+{
+	bench_ulong(1000);
+	bench_ulong(100000);
+	bench_str(4096);
+	bench_str(100000);
+}
+END_TEST
+
+TEST_DEFINE_CASE(bench)
+	TEST(test_htable_bench)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(hashtable_bench,
+		TEST_CASE(bench),
+		TEST_END
+	)
+)
@@ -0,0 +1,277 @@
+/*
+ * TSM - Concurrent Hashtable Tests
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "test_common.h"
+#include "shl-chtable.h"
+
+#define NODE_ALIVE 0x600dcafeUL
+
+struct node {
+	unsigned long key;
+	unsigned long magic;
+};
+
+static bool node_compare(const void *a, const void *b)
+{
+	return *(const unsigned long*)a == *(const unsigned long*)b;
+}
+
+static void node_count_cb(void *elem, void *ctx)
+{
+	unsigned int *num = ctx;
+
+	ck_assert(((struct node*)elem)->magic == NODE_ALIVE);
+	++*num;
+}
+
+START_TEST(test_chtable_basic)
+{
+	struct shl_chtable *t;
+	struct node nodes[1000], dup;
+	unsigned int c, i, num;
+	unsigned long key;
+	void *e;
+	bool b;
+	int r;
+
+	r = shl_chtable_new(&t, node_compare);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < 1000; ++i) {
+		nodes[i].key = i * 7;
+		nodes[i].magic = NODE_ALIVE;
+	}
+
+	/* insert returns the element, a second insert the existing one */
+	r = shl_chtable_insert(t, &nodes[0], nodes[0].key, &e);
+	ck_assert_int_eq(r, 0);
+	ck_assert(e == &nodes[0]);
+
+	dup = nodes[0];
+	r = shl_chtable_insert(t, &dup, dup.key, &e);
+	ck_assert_int_eq(r, -EALREADY);
+	ck_assert(e == &nodes[0]);
+	ck_assert_uint_eq(shl_chtable_get_size(t), 1);
+
+	/* grow through several resizes and find everything */
+	for (i = 1; i < 1000; ++i) {
+		r = shl_chtable_insert(t, &nodes[i], nodes[i].key, NULL);
+		ck_assert_int_eq(r, 0);
+	}
+	ck_assert_uint_eq(shl_chtable_get_size(t), 1000);
+
+	c = shl_chtable_read_lock(t);
+	for (i = 0; i < 1000; ++i) {
+		key = i * 7;
+		b = shl_chtable_lookup(t, &key, key, &e);
+		ck_assert(b);
+		ck_assert(e == &nodes[i]);
+
+		key = i * 7 + 1;
+		b = shl_chtable_lookup(t, &key, key, NULL);
+		ck_assert(!b);
+	}
+	shl_chtable_read_unlock(t, c);
+
+	/* remove every other element, then put them back in deleted slots */
+	for (i = 0; i < 1000; i += 2) {
+		key = i * 7;
+		b = shl_chtable_remove(t, &key, key, &e);
+		ck_assert(b);
+		ck_assert(e == &nodes[i]);
+		b = shl_chtable_remove(t, &key, key, NULL);
+		ck_assert(!b);
+	}
+	ck_assert_uint_eq(shl_chtable_get_size(t), 500);
+	shl_chtable_synchronize(t);
+
+	c = shl_chtable_read_lock(t);
+	for (i = 0; i < 1000; ++i) {
+		key = i * 7;
+		b = shl_chtable_lookup(t, &key, key, NULL);
+		ck_assert(b == (i % 2 == 1));
+	}
+	shl_chtable_read_unlock(t, c);
+
+	for (i = 0; i < 1000; i += 2) {
+		r = shl_chtable_insert(t, &nodes[i], nodes[i].key, NULL);
+		ck_assert_int_eq(r, 0);
+	}
+
+	num = 0;
+	shl_chtable_free(t, node_count_cb, &num);
+	ck_assert_uint_eq(num, 1000);
+}
+END_TEST
+
+/*
+ * Stress test
+ * Reader threads look up a stable key set, which must always hit, and a
+ * churned key set, which may or may not. Meanwhile a writer keeps inserting
+ * and removing heap-allocated churn nodes, forcing resizes, and frees each
+ * removed node only after synchronizing. A reader that ever sees a freed
+ * node trips over the cleared magic (or ASan). Throughput is measured by
+ * bench_chtable, this only checks correctness.
+ */
+
+#define STRESS_STABLE 4096
+#define STRESS_CHURN 4096
+#define STRESS_LOOKUPS 20000
+
+struct stress {
+	struct shl_chtable *t;
+	struct node stable[STRESS_STABLE];
+	unsigned long done;
+};
+
+static void *stress_reader(void *arg)
+{
+	struct stress *s = arg;
+	struct node *n;
+	unsigned long key, seed = (unsigned long)pthread_self();
+	unsigned int i, c;
+	bool b;
+
+	for (i = 0; i < STRESS_LOOKUPS; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 33) % (STRESS_STABLE + STRESS_CHURN);
+
+		c = shl_chtable_read_lock(s->t);
+		b = shl_chtable_lookup(s->t, &key, key, (void**)&n);
+		if (key < STRESS_STABLE)
+			ck_assert(b && n == &s->stable[key]);
+		if (b)
+			ck_assert(n->key == key && n->magic == NODE_ALIVE);
+		shl_chtable_read_unlock(s->t, c);
+	}
+
+	return NULL;
+}
+
+static void *stress_writer(void *arg)
+{
+	struct stress *s = arg;
+	struct node *n, *old;
+	unsigned long key, i = 0;
+	int r;
+
+	while (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+		key = STRESS_STABLE + i++ % STRESS_CHURN;
+
+		n = malloc(sizeof(*n));
+		ck_assert(n != NULL);
+		n->key = key;
+		n->magic = NODE_ALIVE;
+
+		r = shl_chtable_insert(s->t, n, key, NULL);
+		if (r == -EALREADY) {
+			free(n);
+			ck_assert(shl_chtable_remove(s->t, &key, key,
+						     (void**)&old));
+			shl_chtable_synchronize(s->t);
+			old->magic = 0;
+			free(old);
+		} else {
+			ck_assert_int_eq(r, 0);
+		}
+	}
+
+	return NULL;
+}
+
+static void node_free_cb(void *elem, void *ctx)
+{
+	struct node *n = elem;
+
+	if (n->key >= STRESS_STABLE)
+		free(n);
+}
+
+static void stress_run(struct stress *s, unsigned int nreaders)
+{
+	pthread_t readers[nreaders], writer;
+	unsigned int i;
+	int r;
+
+	s->done = 0;
+	r = pthread_create(&writer, NULL, stress_writer, s);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < nreaders; ++i) {
+		r = pthread_create(&readers[i], NULL, stress_reader, s);
+		ck_assert_int_eq(r, 0);
+	}
+	for (i = 0; i < nreaders; ++i)
+		pthread_join(readers[i], NULL);
+
+	__atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+}
+
+START_TEST(test_chtable_stress)
+{
+	struct stress *s;
+	unsigned long i;
+	int r;
+
+	s = calloc(1, sizeof(*s));
+	ck_assert(s != NULL);
+
+	r = shl_chtable_new(&s->t, node_compare);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < STRESS_STABLE; ++i) {
+		s->stable[i].key = i;
+		s->stable[i].magic = NODE_ALIVE;
+		r = shl_chtable_insert(s->t, &s->stable[i], i, NULL);
+		ck_assert_int_eq(r, 0);
+	}
+
+	stress_run(s, 1);
+	stress_run(s, 4);
+
+	shl_chtable_synchronize(s->t);
+	shl_chtable_free(s->t, node_free_cb, NULL);
+	free(s);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_chtable_basic)
+TEST_END_CASE
+
+TEST_DEFINE_CASE(stress)
+	TEST(test_chtable_stress)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(chtable,
+		TEST_CASE(misc),
+		TEST_CASE(stress),
+		TEST_END
+	)
+)
@@ -0,0 +1,384 @@
+/*
+ * TSM - PTY Tests
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "test_common.h"
+#include "shl-pty.h"
+
+#define PTY_FLOOD (1024 * 1024)
+
+/* printable, so the line discipline passes it through unchanged */
+static char pty_byte(size_t off)
+{
+	return 0x21 + (off * 7 + off / 251) % 94;
+}
+
+/* returns how many bytes of @u8 match the stream at offset @off */
+static size_t pty_match(const char *u8, size_t len, size_t off)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		if (u8[i] != pty_byte(off + i))
+			break;
+
+	return i;
+}
+
+/* spawn a child that writes @len stream bytes and then waits to be killed */
+static struct shl_pty *pty_spawn(shl_pty_input_fn fn, void *data, size_t len)
+{
+	struct shl_pty *pty;
+	char buf[4096];
+	size_t off, i, n;
+	ssize_t l;
+	pid_t pid;
+
+	pid = shl_pty_open(&pty, fn, data, 80, 24);
+	ck_assert_int_ge(pid, 0);
+
+	if (!pid) {
+		for (off = 0; off < len; off += l) {
+			n = len - off < sizeof(buf) ? len - off : sizeof(buf);
+			for (i = 0; i < n; ++i)
+				buf[i] = pty_byte(off + i);
+			l = write(STDOUT_FILENO, buf, n);
+			if (l < 0)
+				_exit(1);
+		}
+		for (;;)
+			pause();
+	}
+
+	return pty;
+}
+
+static void pty_kill(struct shl_pty *pty)
+{
+	pid_t pid = shl_pty_get_child(pty);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	shl_pty_unref(pty);
+}
+
+/* bytes waiting in the input ring */
+static size_t pty_pending(struct shl_pty *pty, struct iovec *vec)
+{
+	int num;
+
+	num = shl_pty_peek_input(pty, vec);
+	return num ? vec[0].iov_len + (num > 1 ? vec[1].iov_len : 0) : 0;
+}
+
+/* wait for the pty to become readable, false on timeout */
+static bool pty_wait(struct shl_pty *pty, int timeout)
+{
+	struct pollfd pfd = { .fd = shl_pty_get_fd(pty), .events = POLLIN };
+	int r;
+
+	r = poll(&pfd, 1, timeout);
+	ck_assert_int_ge(r, 0);
+	return r > 0;
+}
+
+struct pty_sink {
+	size_t pos;
+	unsigned int calls;
+};
+
+static void pty_sink_fn(struct shl_pty *pty, void *data, char *u8, size_t len)
+{
+	struct pty_sink *s = data;
+
+	ck_assert_uint_gt(len, 0);
+	ck_assert_uint_eq(pty_match(u8, len, s->pos), len);
+	s->pos += len;
+	++s->calls;
+}
+
+START_TEST(test_pty_ring_callback)
+{
+	struct pty_sink s = { };
+	struct shl_pty *pty;
+	int r;
+
+	pty = pty_spawn(pty_sink_fn, &s, PTY_FLOOD);
+	r = shl_pty_set_input_ring(pty, 256 * 1024);
+	ck_assert_int_eq(r, 0);
+
+	while (s.pos < PTY_FLOOD) {
+		ck_assert(pty_wait(pty, 5000));
+		r = shl_pty_dispatch(pty);
+		ck_assert(r == 0 || r == -EAGAIN);
+	}
+	ck_assert_uint_eq(s.pos, PTY_FLOOD);
+	ck_assert_uint_gt(s.calls, 0);
+
+	/* the released ring is set up again on demand */
+	r = shl_pty_dispatch(pty);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(s.pos, PTY_FLOOD);
+
+	pty_kill(pty);
+}
+END_TEST
+
+START_TEST(test_pty_ring_pull)
+{
+	const size_t limit = 64 * 1024, total = PTY_FLOOD / 4;
+	struct iovec vec[2];
+	struct shl_pty *pty;
+	size_t pos = 0, n;
+	unsigned int full = 0, idle = 0;
+	int r, i, num;
+
+	pty = pty_spawn(NULL, NULL, total);
+	r = shl_pty_set_input_ring(pty, limit);
+	ck_assert_int_eq(r, 0);
+
+	while (pos < total) {
+		if (pty_wait(pty, 100)) {
+			r = shl_pty_dispatch(pty);
+			ck_assert(r == 0 || r == -ENOBUFS);
+			if (r == 0)
+				continue;
+
+			/* a full ring stops reading until data is pulled */
+			++full;
+			ck_assert_uint_eq(pty_pending(pty, vec), limit);
+			r = shl_pty_dispatch(pty);
+			ck_assert_int_eq(r, -ENOBUFS);
+		} else {
+			/* the tail, less than @limit */
+			ck_assert_uint_lt(++idle, 50);
+		}
+
+		num = shl_pty_peek_input(pty, vec);
+		for (i = 0, n = 0; i < num; ++i) {
+			ck_assert_uint_eq(pty_match(vec[i].iov_base,
+						    vec[i].iov_len, pos),
+					  vec[i].iov_len);
+			n += vec[i].iov_len;
+			pos += vec[i].iov_len;
+		}
+		shl_pty_pull_input(pty, n);
+		ck_assert_uint_eq(pty_pending(pty, vec), 0);
+	}
+
+	ck_assert_uint_eq(pos, total);
+	ck_assert_uint_gt(full, 0);
+
+	/* idle dispatches release the grown ring */
+	for (i = 0; i < 4; ++i) {
+		r = shl_pty_dispatch(pty);
+		ck_assert_int_eq(r, 0);
+		ck_assert_uint_eq(pty_pending(pty, vec), 0);
+	}
+
+	pty_kill(pty);
+}
+END_TEST
+
+/*
+ * Bridge
+ * Bridged ptys use plain reads, which return -EAGAIN if a pty still has data
+ * after two reads. Each callback logs which pty it served.
+ */
+
+struct pty_peer {
+	struct shl_pty *pty;
+	size_t pos;
+	int bridge;
+	struct pty_peer *victim;	/* torn down by our next callback */
+};
+
+static struct shl_pty *pty_served;
+
+static void pty_peer_fn(struct shl_pty *pty, void *data, char *u8, size_t len)
+{
+	struct pty_peer *p = data;
+
+	ck_assert_uint_eq(pty_match(u8, len, p->pos), len);
+	p->pos += len;
+	pty_served = pty;
+
+	if (p->victim) {
+		shl_pty_bridge_remove(p->bridge, p->victim->pty);
+		pty_kill(p->victim->pty);
+		p->victim->pty = NULL;
+		p->victim = NULL;
+	}
+}
+
+static int pty_bridge_spawn(struct pty_peer *p, unsigned int num)
+{
+	unsigned int i;
+	int bridge, r;
+
+	bridge = shl_pty_bridge_new();
+	ck_assert_int_ge(bridge, 0);
+
+	for (i = 0; i < num; ++i) {
+		p[i].bridge = bridge;
+		p[i].pty = pty_spawn(pty_peer_fn, &p[i], PTY_FLOOD);
+		r = shl_pty_bridge_add(bridge, p[i].pty);
+		ck_assert_int_eq(r, 0);
+	}
+
+	/* let both children fill their ptys before dispatching */
+	for (i = 0; i < num; ++i)
+		ck_assert(pty_wait(p[i].pty, 5000));
+
+	return bridge;
+}
+
+START_TEST(test_pty_bridge_order)
+{
+	struct pty_peer p[2] = { };
+	struct shl_pty_bridge_stats st;
+	struct shl_pty *last = NULL;
+	unsigned int k, again = 0, turns = 0;
+	bool ready[2], expect_other = false;
+	int bridge, r;
+
+	bridge = pty_bridge_spawn(p, 2);
+
+	for (k = 0; k < 64; ++k) {
+		ready[0] = pty_wait(p[0].pty, 0);
+		ready[1] = pty_wait(p[1].pty, 0);
+
+		pty_served = NULL;
+		r = shl_pty_bridge_dispatch_n(bridge, 5000, 1, &st);
+		ck_assert_int_eq(r, 1);
+		ck_assert_uint_eq(st.dispatched, 1);
+		ck_assert_uint_eq(st.failed, 0);
+		ck_assert_uint_le(st.again, 1);
+		again += st.again;
+
+		/*
+		 * A re-armed pty queues behind the other one if that was
+		 * ready before the re-arm, so it is served next.
+		 */
+		if (expect_other && pty_served) {
+			ck_assert(pty_served != last);
+			++turns;
+		}
+
+		expect_other = false;
+		if (st.again && pty_served) {
+			last = pty_served;
+			expect_other = ready[last == p[0].pty];
+		}
+	}
+
+	ck_assert_uint_gt(again, 0);
+	ck_assert_uint_gt(turns, 0);
+
+	pty_kill(p[0].pty);
+	pty_kill(p[1].pty);
+
+	shl_pty_bridge_free(bridge);
+}
+END_TEST
+
+START_TEST(test_pty_bridge_stats)
+{
+	struct pty_peer p[2] = { };
+	struct shl_pty_bridge_stats st;
+	pid_t pid;
+	int bridge, r, k;
+
+	bridge = pty_bridge_spawn(p, 2);
+
+	r = shl_pty_bridge_dispatch_n(bridge, 5000, 2, &st);
+	ck_assert_int_eq(r, 2);
+	ck_assert_uint_eq(st.dispatched, 2);
+	ck_assert_uint_eq(st.failed, 0);
+
+	/* once its child is gone, a pty fails to dispatch */
+	pid = shl_pty_get_child(p[0].pty);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	for (k = 0; k < 64; ++k) {
+		r = shl_pty_bridge_dispatch_n(bridge, 5000, 2, &st);
+		ck_assert_int_ge(r, 1);
+		ck_assert_uint_eq(st.dispatched, (unsigned int)r);
+		ck_assert_uint_le(st.again + st.failed, st.dispatched);
+		if (st.failed)
+			break;
+	}
+	ck_assert_uint_eq(st.failed, 1);
+
+	shl_pty_bridge_remove(bridge, p[0].pty);
+	shl_pty_unref(p[0].pty);
+	pty_kill(p[1].pty);
+	shl_pty_bridge_free(bridge);
+}
+END_TEST
+
+START_TEST(test_pty_bridge_teardown)
+{
+	struct pty_peer p[2] = { };
+	struct shl_pty_bridge_stats st;
+	int bridge, r;
+
+	/* whoever runs first removes and frees the other */
+	bridge = pty_bridge_spawn(p, 2);
+	p[0].victim = &p[1];
+	p[1].victim = &p[0];
+
+	r = shl_pty_bridge_dispatch_n(bridge, 5000, 2, &st);
+	ck_assert_int_eq(r, 1);
+	ck_assert_uint_eq(st.dispatched, 1);
+	ck_assert(!p[0].pty != !p[1].pty);
+
+	pty_kill(p[0].pty ? p[0].pty : p[1].pty);
+	shl_pty_bridge_free(bridge);
+}
+END_TEST
+
+TEST_DEFINE_CASE(ring)
+	TEST(test_pty_ring_callback)
+	TEST(test_pty_ring_pull)
+TEST_END_CASE
+
+TEST_DEFINE_CASE(bridge)
+	TEST(test_pty_bridge_order)
+	TEST(test_pty_bridge_stats)
+	TEST(test_pty_bridge_teardown)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(pty,
+		TEST_CASE(ring),
+		TEST_CASE(bridge),
+		TEST_END
+	)
+)
@@ -0,0 +1,169 @@
+/*
+ * TSM - Ring Buffer Tests
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "test_common.h"
+#include "shl-ring.h"
+
+/* the byte at stream offset @off, so any misplaced byte is noticed */
+static uint8_t ring_byte(size_t off)
+{
+	return (uint8_t)(off * 7 + off / 251);
+}
+
+static void ring_push_stream(struct shl_ring *r, size_t *wpos, size_t len)
+{
+	uint8_t buf[8192];
+	size_t i;
+	int ret;
+
+	ck_assert(len <= sizeof(buf));
+	for (i = 0; i < len; ++i)
+		buf[i] = ring_byte(*wpos + i);
+
+	ret = shl_ring_push(r, buf, len);
+	ck_assert_int_eq(ret, 0);
+	*wpos += len;
+}
+
+/* like ring_push_stream() but writes in place like readv() would */
+static void ring_commit_stream(struct shl_ring *r, size_t *wpos, size_t len)
+{
+	struct iovec vec[2];
+	size_t i, off = 0;
+	int num, j;
+
+	num = shl_ring_reserve(r, len, vec);
+	ck_assert(num == 1 || num == 2);
+	ck_assert_uint_ge(vec[0].iov_len + (num > 1 ? vec[1].iov_len : 0), len);
+
+	for (j = 0; j < num && off < len; ++j)
+		for (i = 0; i < vec[j].iov_len && off < len; ++i, ++off)
+			((uint8_t*)vec[j].iov_base)[i] = ring_byte(*wpos + off);
+
+	shl_ring_commit(r, len);
+	*wpos += len;
+}
+
+static void ring_pull_stream(struct shl_ring *r, size_t *rpos, size_t len)
+{
+	uint8_t buf[8192];
+	size_t i, n;
+
+	ck_assert(len <= sizeof(buf));
+	n = shl_ring_copy(r, buf, len);
+	ck_assert_uint_eq(n, len);
+	for (i = 0; i < len; ++i)
+		ck_assert_uint_eq(buf[i], ring_byte(*rpos + i));
+
+	shl_ring_pull(r, len);
+	*rpos += len;
+}
+
+/*
+ * Push and pull a stream in uneven chunks so the data wraps repeatedly, and
+ * let it grow while wrapped. Returns the largest number of iovecs peek ever
+ * needed.
+ */
+static size_t ring_exercise(struct shl_ring *r)
+{
+	struct iovec vec[2];
+	size_t wpos = 0, rpos = 0, i, num, len, max = 0;
+
+	for (i = 0; i < 200; ++i) {
+		if (i % 2)
+			ring_commit_stream(r, &wpos, 1000 + i * 37 % 3000);
+		else
+			ring_push_stream(r, &wpos, 1000 + i * 37 % 3000);
+		num = shl_ring_peek(r, vec);
+		if (num > max)
+			max = num;
+		ck_assert_uint_eq(vec[0].iov_len + (num > 1 ? vec[1].iov_len : 0),
+				  shl_ring_get_size(r));
+		ck_assert_uint_eq(*(uint8_t*)vec[0].iov_base, ring_byte(rpos));
+
+		/* keep a growing backlog so resizes happen with wrapped data */
+		len = 900 + i * 53 % 2500;
+		if (len > wpos - rpos)
+			len = wpos - rpos;
+		ring_pull_stream(r, &rpos, len);
+	}
+
+	while (rpos < wpos)
+		ring_pull_stream(r, &rpos,
+				 wpos - rpos < 8192 ? wpos - rpos : 8192);
+	ck_assert_uint_eq(shl_ring_get_size(r), 0);
+
+	return max;
+}
+
+START_TEST(test_ring_plain)
+{
+	struct shl_ring r;
+
+	memset(&r, 0, sizeof(r));
+	ck_assert_uint_eq(ring_exercise(&r), 2);
+	shl_ring_clear(&r);
+}
+END_TEST
+
+START_TEST(test_ring_mirror)
+{
+	struct shl_ring r;
+	size_t size;
+	int ret;
+
+	memset(&r, 0, sizeof(r));
+	ret = shl_ring_init_mirror(&r, 0);
+	if (ret == -EOPNOTSUPP)
+		return;
+	ck_assert_int_eq(ret, 0);
+	ck_assert(r.mirror);
+	ck_assert_int_eq(shl_ring_init_mirror(&r, 0), -EBUSY);
+
+	size = r.size;
+	ck_assert_uint_eq(ring_exercise(&r), 1);
+	ck_assert_uint_gt(r.size, size);
+
+	/* both views show the same pages */
+	r.buf[0] = 0x42;
+	ck_assert_uint_eq(r.buf[r.size], 0x42);
+
+	shl_ring_clear(&r);
+	ck_assert(!r.mirror && !r.buf);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_ring_plain)
+	TEST(test_ring_mirror)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(ring,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
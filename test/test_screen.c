@@ -23,6 +23,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <string.h>
 #include "test_common.h"
 #include "libtsm.h"
 #include "libtsm-int.h"
@@ -133,15 +134,956 @@ START_TEST(test_screen_null)
 }
 END_TEST
 
+static int count_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		    size_t len, unsigned int width, unsigned int posx,
+		    unsigned int posy, const struct tsm_screen_attr *attr,
+		    tsm_age_t age, void *data)
+{
+	unsigned int *num = data;
+
+	++*num;
+	return 0;
+}
+
+START_TEST(test_screen_draw_since)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	unsigned int num;
+	tsm_age_t age;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 24);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+
+	num = 0;
+	age = tsm_screen_draw_since(screen, 0, count_cb, &num);
+	ck_assert_int_eq(num, 80 * 24);
+
+	num = 0;
+	age = tsm_screen_draw_since(screen, age, count_cb, &num);
+	ck_assert_int_eq(num, 0);
+
+	/* written cell plus old and new cursor cell */
+	tsm_screen_write(screen, 'a', &attr);
+	num = 0;
+	age = tsm_screen_draw_since(screen, age, count_cb, &num);
+	ck_assert_int_eq(num, 2);
+
+	tsm_screen_move_to(screen, 10, 10);
+	num = 0;
+	age = tsm_screen_draw_since(screen, age, count_cb, &num);
+	ck_assert_int_eq(num, 2);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static int run_cb(struct tsm_screen *con, const struct tsm_screen_run *run,
+		  void *data)
+{
+	unsigned int *cells = data;
+
+	ck_assert_int_eq(run->posx, cells[run->posy]);
+	ck_assert_int_eq(run->len, run->cells);
+	cells[run->posy] += run->cells;
+	++cells[24];
+	return 0;
+}
+
+START_TEST(test_screen_draw_runs)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	unsigned int cells[25], i;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 24);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+
+	tsm_screen_write(screen, 'a', &attr);
+	tsm_screen_write(screen, 'b', &attr);
+
+	/* one run per row, the cursor splits row 0 into three */
+	memset(cells, 0, sizeof(cells));
+	tsm_screen_draw_runs(screen, run_cb, cells);
+	for (i = 0; i < 24; ++i)
+		ck_assert_int_eq(cells[i], 80);
+	ck_assert_int_eq(cells[24], 24 + 2);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_export)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	struct tsm_cell_export buf;
+	tsm_symbol_t glyphs[96 * 24];
+	uint32_t fg[96 * 24], bg[96 * 24];
+	uint16_t flags[96 * 24];
+	uint8_t rows[24];
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 24);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+	attr.fr = 0xff;
+	attr.bold = 1;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.glyphs = glyphs;
+	buf.fg = fg;
+	buf.bg = bg;
+	buf.flags = flags;
+	buf.rows = rows;
+
+	r = tsm_screen_export(screen, &buf, 79, 0);
+	ck_assert_int_eq(r, -EINVAL);
+
+	tsm_screen_move_to(screen, 0, 1);
+	tsm_screen_write(screen, 'a', &attr);
+	r = tsm_screen_export(screen, &buf, 96, 0);
+	ck_assert_int_eq(r, 24);
+	ck_assert_int_eq(glyphs[96], 'a');
+	ck_assert_int_eq(fg[96], 0xff0000);
+	ck_assert_int_eq(flags[96], TSM_CELL_BOLD);
+	/* cursor cell is exported inverted */
+	ck_assert_int_eq(bg[97], fg[98]);
+	ck_assert_int_eq(fg[97], bg[98]);
+	ck_assert(flags[97] & TSM_CELL_INVERSE);
+
+	r = tsm_screen_export(screen, &buf, 96, TSM_SCREEN_EXPORT_DIRTY);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(rows[1], 0);
+
+	tsm_screen_write(screen, 'b', &attr);
+	r = tsm_screen_export(screen, &buf, 96, TSM_SCREEN_EXPORT_DIRTY);
+	ck_assert_int_eq(r, 1);
+	ck_assert_int_eq(rows[1], 1);
+	ck_assert_int_eq(glyphs[97], 'b');
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static int inverse_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		      size_t len, unsigned int width, unsigned int posx,
+		      unsigned int posy, const struct tsm_screen_attr *attr,
+		      tsm_age_t age, void *data)
+{
+	bool *inv = data;
+
+	inv[posy * 10 + posx] = attr->inverse;
+	return 0;
+}
+
+START_TEST(test_screen_draw_selection)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	struct tsm_cell_export buf;
+	tsm_symbol_t glyphs[50];
+	uint32_t fg[50], bg[50];
+	uint16_t flags[50];
+	bool inv[50], sel;
+	unsigned int i, x, y;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 5);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 10);
+	tsm_screen_set_flags(screen, TSM_SCREEN_HIDE_CURSOR);
+	memset(&attr, 0, sizeof(attr));
+
+	for (i = 0; i < 8; ++i) {
+		tsm_screen_write(screen, 'a' + i, &attr);
+		tsm_screen_newline(screen);
+	}
+
+	/* selection starts in the scroll-back buffer and ends on screen */
+	tsm_screen_sb_up(screen, 2);
+	tsm_screen_selection_start(screen, 3, 1);
+	tsm_screen_selection_target(screen, 5, 3);
+
+	memset(&buf, 0, sizeof(buf));
+	buf.glyphs = glyphs;
+	buf.fg = fg;
+	buf.bg = bg;
+	buf.flags = flags;
+	r = tsm_screen_export(screen, &buf, 10, 0);
+	ck_assert_int_eq(r, 5);
+	tsm_screen_draw(screen, inverse_cb, inv);
+
+	for (y = 0; y < 5; ++y) {
+		for (x = 0; x < 10; ++x) {
+			sel = (y == 1 && x >= 3) || y == 2 ||
+			      (y == 3 && x <= 5);
+			ck_assert_int_eq(inv[y * 10 + x], sel);
+			ck_assert_int_eq(!!(flags[y * 10 + x] &
+					    TSM_CELL_INVERSE), sel);
+		}
+	}
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static int id_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		 size_t len, unsigned int width, unsigned int posx,
+		 unsigned int posy, const struct tsm_screen_attr *attr,
+		 tsm_age_t age, void *data)
+{
+	uint64_t *ids = data;
+
+	/* each cell is drawn exactly once, so no locking is needed */
+	ids[posy * 80 + posx] = id + 1;
+	return 0;
+}
+
+START_TEST(test_screen_draw_parallel)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	static const unsigned int nthreads[] = { 1, 4, 7, 2, 7, 100 };
+	static uint64_t ids[80 * 64], par[80 * 64];
+	unsigned int i;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 64);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+
+	for (i = 0; i < 80 * 60; ++i)
+		tsm_screen_write(screen, 'a' + i % 26, &attr);
+	tsm_screen_selection_start(screen, 10, 3);
+	tsm_screen_selection_target(screen, 20, 57);
+
+	/* the worker pool is kept and reused across frames of any size */
+	memset(ids, 0, sizeof(ids));
+	tsm_screen_draw(screen, id_cb, ids);
+	for (i = 0; i < sizeof(nthreads) / sizeof(*nthreads); ++i) {
+		memset(par, 0, sizeof(par));
+		tsm_screen_draw_parallel(screen, 0, nthreads[i], id_cb, par);
+		ck_assert(!memcmp(ids, par, sizeof(ids)));
+	}
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static void change_cb(struct tsm_screen *con, void *data)
+{
+	unsigned int *num = data;
+
+	++*num;
+}
+
+START_TEST(test_screen_change)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	unsigned int num = 0, cells = 0;
+	tsm_age_t age;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 24);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+
+	ck_assert(tsm_screen_needs_redraw(screen, 0));
+	age = tsm_screen_draw(screen, count_cb, &cells);
+	ck_assert(!tsm_screen_needs_redraw(screen, age));
+
+	tsm_screen_set_change_cb(screen, change_cb, &num);
+	tsm_screen_write(screen, 'a', &attr);
+	tsm_screen_write(screen, 'b', &attr);
+	tsm_screen_move_to(screen, 5, 5);
+	ck_assert_int_eq(num, 1);
+	ck_assert(tsm_screen_needs_redraw(screen, age));
+
+	age = tsm_screen_draw_since(screen, age, count_cb, &cells);
+	ck_assert(!tsm_screen_needs_redraw(screen, age));
+	tsm_screen_write(screen, 'c', &attr);
+	ck_assert_int_eq(num, 2);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_draw_region)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	static uint64_t ids[80 * 24], reg[80 * 24];
+	unsigned int i, x, y;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 80, 24);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 100);
+	memset(&attr, 0, sizeof(attr));
+
+	for (i = 0; i < 80 * 30; ++i)
+		tsm_screen_write(screen, 'a' + i % 26, &attr);
+	tsm_screen_sb_up(screen, 4);
+
+	memset(ids, 0, sizeof(ids));
+	tsm_screen_draw(screen, id_cb, ids);
+	memset(reg, 0, sizeof(reg));
+	tsm_screen_draw_region(screen, 70, 2, 20, 5, id_cb, reg);
+
+	for (y = 0; y < 24; ++y) {
+		for (x = 0; x < 80; ++x) {
+			if (x >= 70 && y >= 2 && y < 7)
+				ck_assert_int_eq(reg[y * 80 + x],
+						 ids[y * 80 + x]);
+			else
+				ck_assert_int_eq(reg[y * 80 + x], 0);
+		}
+	}
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+struct diff_buf {
+	char buf[16384];
+	size_t len;
+};
+
+static void diff_cb(struct tsm_screen *con, const char *u8, size_t len,
+		    void *data)
+{
+	struct diff_buf *b = data;
+
+	ck_assert(b->len + len <= sizeof(b->buf));
+	memcpy(&b->buf[b->len], u8, len);
+	b->len += len;
+}
+
+static void vte_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		   void *data)
+{
+}
+
+static void export_grid(struct tsm_screen *screen, tsm_symbol_t *glyphs,
+			uint32_t *fg, uint32_t *bg, uint16_t *flags)
+{
+	struct tsm_cell_export buf;
+	int r;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.glyphs = glyphs;
+	buf.fg = fg;
+	buf.bg = bg;
+	buf.flags = flags;
+	r = tsm_screen_export(screen, &buf, 40, 0);
+	ck_assert_int_eq(r, 10);
+}
+
+static void diff_compare(struct tsm_screen *a, struct tsm_screen *b)
+{
+	static tsm_symbol_t ga[400], gb[400];
+	static uint32_t fa[400], fb[400], ba[400], bb[400];
+	static uint16_t la[400], lb[400];
+	unsigned int i;
+
+	export_grid(a, ga, fa, ba, la);
+	export_grid(b, gb, fb, bb, lb);
+	for (i = 0; i < 400; ++i) {
+		/* empty cells and spaces look the same */
+		if (ga[i] == ' ')
+			ga[i] = 0;
+		if (gb[i] == ' ')
+			gb[i] = 0;
+	}
+
+	ck_assert(!memcmp(ga, gb, sizeof(ga)));
+	ck_assert(!memcmp(fa, fb, sizeof(fa)));
+	ck_assert(!memcmp(ba, bb, sizeof(ba)));
+	ck_assert(!memcmp(la, lb, sizeof(la)));
+}
+
+START_TEST(test_screen_diff)
+{
+	static const char input[] =
+		"hello \e[1;31mworld\e[0m\r\n"
+		"\e[5;3H==================== \xe4\xb8\xad!"
+		"\e[7;5H\e[44m          \e[0m"
+		"\e[38;2;1;2;3mrgb\e[0m\e[9;40Hx\e[3;1H";
+	struct tsm_screen *src, *dst;
+	struct tsm_vte *vsrc, *vdst;
+	struct tsm_screen_snapshot *snap;
+	static struct diff_buf out;
+	unsigned int num = 0;
+	int r;
+
+	r = tsm_screen_new(&src, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(src, 40, 10);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vsrc, src, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_new(&dst, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(dst, 40, 10);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vdst, dst, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_snapshot_new(&snap);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vsrc, input, sizeof(input) - 1);
+
+	out.len = 0;
+	r = tsm_screen_diff(src, snap, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	tsm_vte_input(vdst, out.buf, out.len);
+	diff_compare(src, dst);
+	ck_assert_int_eq(tsm_screen_get_cursor_x(dst), 0);
+	ck_assert_int_eq(tsm_screen_get_cursor_y(dst), 2);
+
+	/* nothing changed, nothing to send */
+	out.len = 0;
+	r = tsm_screen_diff(src, snap, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, 0);
+
+	tsm_vte_input(vsrc, "\e[1;2HE\e[2K", 8);
+	out.len = 0;
+	r = tsm_screen_diff(src, snap, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert(out.len < 16);
+	tsm_vte_input(vdst, out.buf, out.len);
+	diff_compare(src, dst);
+
+	/* a diff counts as a draw and re-arms the change callback */
+	tsm_screen_set_change_cb(src, change_cb, &num);
+	tsm_screen_move_to(src, 0, 0);
+	ck_assert_int_eq(num, 1);
+	out.len = 0;
+	r = tsm_screen_diff(src, snap, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_move_to(src, 1, 1);
+	ck_assert_int_eq(num, 2);
+
+	tsm_screen_snapshot_free(snap);
+	tsm_vte_unref(vdst);
+	tsm_screen_unref(dst);
+	tsm_vte_unref(vsrc);
+	tsm_screen_unref(src);
+}
+END_TEST
+
+START_TEST(test_screen_line_hash)
+{
+	struct tsm_screen *a, *b;
+	struct tsm_screen_attr attr;
+	uint64_t h;
+	int r;
+
+	r = tsm_screen_new(&a, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(a, 80, 24);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_new(&b, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(b, 80, 24);
+	ck_assert_int_eq(r, 0);
+	memset(&attr, 0, sizeof(attr));
+
+	ck_assert_int_eq(tsm_screen_get_line_hash(a, 24), 0);
+	ck_assert(tsm_screen_get_line_hash(a, 0) ==
+		  tsm_screen_get_line_hash(b, 0));
+	ck_assert(tsm_screen_get_line_hash(a, 0) ==
+		  tsm_screen_get_line_hash(a, 1));
+
+	tsm_screen_write(a, 'x', &attr);
+	tsm_screen_write(b, 'x', &attr);
+	h = tsm_screen_get_line_hash(a, 0);
+	ck_assert(h != tsm_screen_get_line_hash(a, 1));
+	ck_assert(h == tsm_screen_get_line_hash(b, 0));
+
+	/* attributes are part of the hash, cursor moves are not */
+	attr.bold = 1;
+	tsm_screen_move_to(b, 0, 0);
+	tsm_screen_write(b, 'x', &attr);
+	ck_assert(h != tsm_screen_get_line_hash(b, 0));
+	tsm_screen_move_to(a, 10, 0);
+	ck_assert(h == tsm_screen_get_line_hash(a, 0));
+
+	/* cells beyond the visible width do not count after a shrink */
+	attr.bold = 0;
+	tsm_screen_move_to(b, 0, 0);
+	tsm_screen_write(b, 'x', &attr);
+	tsm_screen_move_to(a, 60, 0);
+	tsm_screen_write(a, 'y', &attr);
+	ck_assert(h != tsm_screen_get_line_hash(a, 0));
+	r = tsm_screen_resize(a, 40, 24);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(b, 40, 24);
+	ck_assert_int_eq(r, 0);
+	ck_assert(tsm_screen_get_line_hash(a, 0) ==
+		  tsm_screen_get_line_hash(b, 0));
+
+	tsm_screen_unref(b);
+	tsm_screen_unref(a);
+}
+END_TEST
+
+START_TEST(test_screen_dump)
+{
+	static const char input[] = "a<b\r\n\e[1mB\e[0m\r\nc  \r\nd";
+	static const char ansi[] =
+		"\e[0ma<b\r\n\e[1mB\r\n\e[0mc\r\nd\r\n";
+	static const char html[] =
+		"<pre class=\"tsm\">a&lt;b\n"
+		"<span style=\"font-weight:bold;\">B\n</span>c\nd\n</pre>\n";
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	static struct diff_buf out;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 10);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vte, input, sizeof(input) - 1);
+
+	r = tsm_screen_dump(screen, 42, diff_cb, &out);
+	ck_assert_int_eq(r, -EINVAL);
+
+	out.len = 0;
+	r = tsm_screen_dump(screen, TSM_SCREEN_DUMP_ANSI, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, sizeof(ansi) - 1);
+	ck_assert(!memcmp(out.buf, ansi, out.len));
+
+	out.len = 0;
+	r = tsm_screen_dump(screen, TSM_SCREEN_DUMP_HTML, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, sizeof(html) - 1);
+	ck_assert(!memcmp(out.buf, html, out.len));
+
+	/* the alternate screen is not part of the dump */
+	tsm_vte_input(vte, "\e[?1049hzz", 10);
+	out.len = 0;
+	r = tsm_screen_dump(screen, TSM_SCREEN_DUMP_ANSI, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, sizeof(ansi) - 1);
+	ck_assert(!memcmp(out.buf, ansi, out.len));
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_selection_copy_cb)
+{
+	static const char input[] = "ab  \r\n\xe4\xb8\xad""c\r\nline3";
+	static const char all[] = "ab\n\xe4\xb8\xad""c\nline3\n";
+	static const char sel[] = "b\n\xe4\xb8\xad""c\nlin";
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	static struct diff_buf out;
+	char *str;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vte, input, sizeof(input) - 1);
+
+	r = tsm_screen_selection_copy_cb(screen, diff_cb, &out);
+	ck_assert_int_eq(r, -ENOENT);
+
+	out.len = 0;
+	r = tsm_screen_copy_all_cb(screen, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, sizeof(all) - 1);
+	ck_assert(!memcmp(out.buf, all, out.len));
+
+	r = tsm_screen_copy_all(screen, &str);
+	ck_assert_int_eq(r, sizeof(all) - 1);
+	ck_assert_str_eq(str, all);
+	free(str);
+
+	tsm_screen_selection_start(screen, 1, 0);
+	tsm_screen_selection_target(screen, 2, 2);
+
+	out.len = 0;
+	r = tsm_screen_selection_copy_cb(screen, diff_cb, &out);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(out.len, sizeof(sel) - 1);
+	ck_assert(!memcmp(out.buf, sel, out.len));
+
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, sizeof(sel) - 1);
+	ck_assert_str_eq(str, sel);
+	free(str);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+struct copy_cmp {
+	const char *expect;
+	size_t len;
+	bool match;
+};
+
+static void copy_cmp_cb(struct tsm_screen *con, const char *u8, size_t len,
+			void *data)
+{
+	struct copy_cmp *c = data;
+
+	if (memcmp(&c->expect[c->len], u8, len))
+		c->match = false;
+	c->len += len;
+}
+
+START_TEST(test_screen_copy_all_large)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct copy_cmp cmp;
+	char line[32], *str;
+	unsigned int i;
+	int r, len;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 20, 4);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 5000);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < 5000; ++i) {
+		len = snprintf(line, sizeof(line), "%u \xc3\xa4\r\n", i);
+		tsm_vte_input(vte, line, len);
+	}
+
+	r = tsm_screen_copy_all(screen, &str);
+	ck_assert_int_gt(r, 0);
+	ck_assert_int_eq(strlen(str), r);
+	ck_assert(!strncmp(str, "0 \xc3\xa4\n1 \xc3\xa4\n", 10));
+	ck_assert_str_eq(&str[r - 9], "4999 \xc3\xa4\n\n");
+
+	cmp.expect = str;
+	cmp.len = 0;
+	cmp.match = true;
+	r = tsm_screen_copy_all_cb(screen, copy_cmp_cb, &cmp);
+	ck_assert_int_eq(r, 0);
+	ck_assert(cmp.match);
+	ck_assert_int_eq(cmp.len, strlen(str));
+
+	free(str);
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_selection_word)
+{
+	static const char input[] =
+		"see http://x.org/a_b ok\r\n\xe4\xb8\xad\xe6\x96\x87 ab";
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	char *str;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 4);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vte, input, sizeof(input) - 1);
+
+	/* URL continues across the soft-wrap */
+	tsm_screen_selection_word(screen, 6, 0);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "http://x.org/a_b");
+	free(str);
+
+	tsm_screen_selection_word(screen, 1, 2);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "ok");
+	free(str);
+
+	/* both halves of a wide character select the CJK run */
+	tsm_screen_selection_word(screen, 3, 3);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "\xe4\xb8\xad\xe6\x96\x87");
+	free(str);
+
+	tsm_screen_selection_line(screen, 1);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "see http://x.org/a_b ok");
+	free(str);
+
+	r = tsm_screen_set_word_chars(screen, "\xc3\xa4");
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_set_word_chars(screen, "");
+	ck_assert_int_eq(r, 0);
+	tsm_screen_selection_word(screen, 6, 0);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_ge(r, 0);
+	ck_assert_str_eq(str, "http");
+	free(str);
+
+	/* clicking a blank selects nothing */
+	tsm_screen_selection_reset(screen);
+	tsm_screen_selection_word(screen, 3, 0);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, -ENOENT);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static void copy_expect(struct tsm_screen *screen, const char *expect)
+{
+	char *str;
+	int r;
+
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, strlen(expect));
+	ck_assert_str_eq(str, expect);
+	free(str);
+}
+
+START_TEST(test_screen_selection_scroll)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 2);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vte, "a\r\nb\r\nc", 7);
+	tsm_screen_selection_start(screen, 0, 0);
+	tsm_screen_selection_target(screen, 0, 1);
+	copy_expect(screen, "a\nb");
+
+	/* the selection moves into the scroll-back buffer with its lines */
+	tsm_vte_input(vte, "\r\nd\r\ne", 6);
+	copy_expect(screen, "a\nb");
+
+	/* and is cut off as they are dropped */
+	tsm_vte_input(vte, "\r\nf", 3);
+	copy_expect(screen, "b");
+	tsm_vte_input(vte, "\r\ng", 3);
+	copy_expect(screen, "");
+
+	/* scrolling down moves the selection with the screen content */
+	tsm_screen_selection_start(screen, 0, 1);
+	copy_expect(screen, "f");
+	tsm_screen_scroll_down(screen, 1);
+	copy_expect(screen, "f");
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_selection_margins)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	char *str;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 5);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 10);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	/* only anchors inside the scroll region move with it */
+	tsm_vte_input(vte, "a\r\nb\r\nc\r\nd\r\ne\e[2;4r", 19);
+	tsm_screen_selection_start(screen, 0, 2);
+	tsm_screen_selection_target(screen, 0, 4);
+	copy_expect(screen, "c\nd\ne");
+	tsm_vte_input(vte, "\e[4;1H\n", 7);
+	copy_expect(screen, "c\nd\n\ne");
+	tsm_vte_input(vte, "\e[2;1H\eM", 8);
+	copy_expect(screen, "c\nd\ne");
+
+	/* a selection that scrolls out of the region is gone */
+	tsm_screen_selection_start(screen, 0, 2);
+	tsm_screen_selection_target(screen, 0, 3);
+	copy_expect(screen, "c\nd");
+	tsm_vte_input(vte, "\eM\eM", 4);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, -ENOENT);
+
+	/* the alternate screen neither moves nor keeps the selection */
+	tsm_vte_input(vte, "\e[r", 3);
+	tsm_screen_selection_start(screen, 0, 0);
+	tsm_vte_input(vte, "\e[5;1H\n", 7);
+	copy_expect(screen, "a");
+	tsm_vte_input(vte, "\e[?1049h\n\n\n\n\n\n", 14);
+	copy_expect(screen, "a");
+	tsm_vte_input(vte, "\e[?1049l", 8);
+	copy_expect(screen, "a");
+
+	tsm_screen_selection_start(screen, 0, 0);
+	tsm_vte_input(vte, "\e[?1049h", 8);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, -ENOENT);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_screen_symbol_gc)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct tsm_screen_symbol_stats st;
+	unsigned long epoch;
+	unsigned int i;
+	char buf[16];
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 2);
+	r = tsm_vte_new(&vte, screen, vte_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	tsm_vte_input(vte, "a\xcc\x81", 3);
+	r = tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(st.live, 1);
+	ck_assert_uint_eq(st.dead, 0);
+
+	/* erased symbols are dead until collected */
+	tsm_vte_input(vte, "\e[2J\e[H", 7);
+	tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_uint_eq(st.live, 0);
+	ck_assert_uint_eq(st.dead, 1);
+	epoch = st.epoch;
+	ck_assert_uint_eq(tsm_screen_get_symbol_epoch(screen), epoch);
+
+	r = tsm_screen_collect_symbols(screen);
+	ck_assert_int_eq(r, 1);
+	tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_uint_eq(st.dead, 0);
+	ck_assert_uint_eq(st.free_ids, 1);
+	ck_assert_uint_ne(st.epoch, epoch);
+	ck_assert_uint_eq(tsm_screen_get_symbol_epoch(screen), st.epoch);
+
+	/* the freed id is reused for a different symbol */
+	tsm_vte_input(vte, "b\xcc\x80", 3);
+	tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_uint_eq(st.live, 1);
+	ck_assert_uint_eq(st.free_ids, 0);
+	tsm_screen_selection_start(screen, 0, 0);
+	tsm_screen_selection_target(screen, 0, 0);
+	copy_expect(screen, "b\xcc\x80");
+	tsm_screen_selection_reset(screen);
+
+	/* symbols evicted from the scroll-back buffer are collected */
+	for (i = 0; i < 5000; ++i) {
+		buf[0] = '\r';
+		buf[1] = '\n';
+		buf[2] = 'a' + i % 26;
+		buf[3] = 0xcc + (i / 26 % 64) / 48;
+		buf[4] = 0x80 + (i / 26 % 64) % 48;
+		buf[5] = 0xcd;
+		buf[6] = 0x80 + i / 26 / 64;
+		tsm_vte_input(vte, buf, 7);
+	}
+	tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_uint_eq(st.live, 5);
+	ck_assert_uint_gt(st.collections, 0);
+	ck_assert_uint_lt(st.live + st.dead, 2048);
+
+	tsm_screen_clear_sb(screen);
+	tsm_screen_get_symbol_stats(screen, &st);
+	ck_assert_uint_eq(st.live, 3);
+	ck_assert_uint_eq(st.dead, 0);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
 
 TEST_DEFINE_CASE(misc)
 	TEST(test_screen_init)
 	TEST(test_screen_null)
 TEST_END_CASE
 
+TEST_DEFINE_CASE(draw)
+	TEST(test_screen_draw_since)
+	TEST(test_screen_draw_runs)
+	TEST(test_screen_export)
+	TEST(test_screen_draw_selection)
+	TEST(test_screen_draw_parallel)
+	TEST(test_screen_change)
+	TEST(test_screen_draw_region)
+	TEST(test_screen_diff)
+	TEST(test_screen_line_hash)
+	TEST(test_screen_dump)
+	TEST(test_screen_selection_copy_cb)
+	TEST(test_screen_copy_all_large)
+	TEST(test_screen_selection_word)
+	TEST(test_screen_selection_scroll)
+	TEST(test_screen_selection_margins)
+	TEST(test_screen_symbol_gc)
+TEST_END_CASE
+
 TEST_DEFINE(
 	TEST_SUITE(screen,
 		TEST_CASE(misc),
+		TEST_CASE(draw),
 		TEST_END
 	)
 )
@@ -26,6 +26,7 @@
 #include "test_common.h"
 #include "libtsm.h"
 #include "libtsm-int.h"
+#include "wcwidth/wcwidth.h"
 
 START_TEST(test_symbol_null)
 {
@@ -64,9 +65,138 @@ START_TEST(test_symbol_init)
 }
 END_TEST
 
+START_TEST(test_symbol_width)
+{
+	uint32_t i, bad = UINT32_MAX;
+	int w;
+
+	/*
+	 * The generated tables must match the data they were built from. Check
+	 * records every passing assertion, so compare silently and assert once.
+	 */
+	for (i = 0; i <= 0x10ffff; ++i) {
+		w = tsm_wcwidth(i);
+		if (tsm_ucs4_get_width(i) != (w > 0 ? w : 0)) {
+			bad = i;
+			break;
+		}
+	}
+	ck_assert_msg(bad == UINT32_MAX, "width mismatch at U+%04X", bad);
+
+	ck_assert_int_eq(tsm_ucs4_get_width(0x110000), 1);
+	ck_assert_int_eq(tsm_ucs4_get_width(TSM_UCS4_MAX), 1);
+}
+END_TEST
+
+START_TEST(test_symbol_append)
+{
+	struct tsm_symbol_table *t;
+	tsm_symbol_t syms[2000], s;
+	const uint32_t *ch;
+	size_t len;
+	unsigned int i;
+	int r;
+
+	r = tsm_symbol_table_new(&t);
+	ck_assert(!r);
+
+	for (i = 0; i < 2000; ++i) {
+		s = tsm_symbol_append(t, 'a' + i % 26, 0x300 + i / 26);
+		syms[i] = tsm_symbol_append(t, s, 0x301);
+		ck_assert(syms[i] > TSM_UCS4_MAX);
+	}
+
+	/* equal strings map to the same symbol */
+	s = tsm_symbol_append(t, 'a', 0x300);
+	ck_assert(tsm_symbol_append(t, s, 0x301) == syms[0]);
+
+	for (i = 0; i < 2000; ++i) {
+		ch = tsm_symbol_get(t, &syms[i], &len);
+		ck_assert_int_eq(len, 3);
+		ck_assert_int_eq(ch[0], 'a' + i % 26);
+		ck_assert_int_eq(ch[1], 0x300 + i / 26);
+		ck_assert_int_eq(ch[2], 0x301);
+	}
+
+	/* collect everything but the final symbols and refill the table */
+	r = tsm_symbol_table_mark_begin(t);
+	ck_assert(!r);
+	for (i = 0; i < 2000; ++i)
+		tsm_symbol_table_mark(t, syms[i]);
+	ck_assert_int_eq(tsm_symbol_table_sweep(t), 2000);
+
+	for (i = 0; i < 2000; ++i) {
+		s = tsm_symbol_append(t, 'A' + i % 26, 0x300 + i / 26);
+		ck_assert(s > TSM_UCS4_MAX);
+		ch = tsm_symbol_get(t, &s, &len);
+		ck_assert_int_eq(len, 2);
+		ck_assert_int_eq(ch[0], 'A' + i % 26);
+	}
+
+	for (i = 0; i < 2000; ++i) {
+		ch = tsm_symbol_get(t, &syms[i], &len);
+		ck_assert_int_eq(len, 3);
+		ck_assert_int_eq(ch[1], 0x300 + i / 26);
+	}
+
+	/* cached appends must not return IDs that were freed and reused */
+	s = tsm_symbol_append(t, 'x', 0x300);
+	tsm_symbol_table_mark_begin(t);
+	ck_assert_int_eq(tsm_symbol_table_sweep(t), 4001);
+	ck_assert(tsm_symbol_append(t, 'y', 0x301) == s);
+	s = tsm_symbol_append(t, 'x', 0x300);
+	ch = tsm_symbol_get(t, &s, &len);
+	ck_assert_int_eq(len, 2);
+	ck_assert_int_eq(ch[0], 'x');
+
+	tsm_symbol_table_unref(t);
+}
+END_TEST
+
+START_TEST(test_symbol_utf8_bulk)
+{
+	static const uint32_t pool[] = {
+		'a', 0x7f, 0x80, 0x3b1, 0x7ff, 0x800, 0x4e00, 0xd7ff, 0xd800,
+		0xfdd0, 0xfffe, 0xffff, 0x10000, 0x1f600, 0x10ffff, 0x110000,
+		0x80000000, 0xffffffff,
+	};
+	uint32_t ucs4[64];
+	char expect[64 * 4], out[64 * 4];
+	unsigned int i, j, len, seed = 1;
+	size_t n, r;
+
+	for (i = 0; i < 2000; ++i) {
+		len = i % 64;
+		n = 0;
+		for (j = 0; j < len; ++j) {
+			seed = seed * 1103515245 + 12345;
+			/* runs of ASCII or 2-byte characters with some noise */
+			if (i % 3 == 0)
+				ucs4[j] = 0x20 + (seed >> 16) % 0x5f;
+			else if (i % 3 == 1)
+				ucs4[j] = 0x80 + (seed >> 16) % 0x780;
+			else
+				ucs4[j] = pool[(seed >> 16) % 18];
+			if (i % 7 == 0 && j == len / 2)
+				ucs4[j] = pool[i % 18];
+			n += tsm_ucs4_to_utf8(ucs4[j], &expect[n]);
+		}
+
+		r = tsm_ucs4_to_utf8_bulk(ucs4, len, NULL);
+		ck_assert_int_eq(r, n);
+		r = tsm_ucs4_to_utf8_bulk(ucs4, len, out);
+		ck_assert_int_eq(r, n);
+		ck_assert(!memcmp(out, expect, n));
+	}
+}
+END_TEST
+
 TEST_DEFINE_CASE(misc)
 	TEST(test_symbol_null)
 	TEST(test_symbol_init)
+	TEST(test_symbol_append)
+	TEST(test_symbol_width)
+	TEST(test_symbol_utf8_bulk)
 TEST_END_CASE
 
 TEST_DEFINE(
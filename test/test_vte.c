@@ -157,10 +157,78 @@ START_TEST(test_vte_custom_palette)
 }
 END_TEST
 
+static void copy_all_expect(struct tsm_screen *screen, const char *expect)
+{
+	char *str;
+	int r;
+
+	r = tsm_screen_copy_all(screen, &str);
+	ck_assert_int_eq(r, strlen(expect));
+	ck_assert_str_eq(str, expect);
+	free(str);
+}
+
+static void copy_cell_expect(struct tsm_screen *screen, unsigned int x,
+			     unsigned int y, const char *expect)
+{
+	char *str;
+	int r;
+
+	tsm_screen_selection_start(screen, x, y);
+	tsm_screen_selection_target(screen, x, y);
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, strlen(expect));
+	ck_assert_str_eq(str, expect);
+	free(str);
+	tsm_screen_selection_reset(screen);
+}
+
+START_TEST(test_vte_grapheme)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 2);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	/* combining marks join the previous cell */
+	tsm_vte_input(vte, "e\xcc\x81x", 4);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 2);
+	copy_all_expect(screen, "e\xcc\x81x\n\n");
+
+	/*
+	 * The ZWJ joins the previous cell, but the wide emoji after it keeps
+	 * its own cells like wcwidth() says: cells 0-1, 2-3 and 4.
+	 */
+	tsm_vte_input(vte, "\r\n\xf0\x9f\x91\xa9\xe2\x80\x8d"
+			   "\xf0\x9f\x92\xbb|", 14);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 5);
+	copy_all_expect(screen, "e\xcc\x81x\n\xf0\x9f\x91\xa9"
+				"\xe2\x80\x8d\xf0\x9f\x92\xbb|\n");
+	copy_cell_expect(screen, 0, 1, "\xf0\x9f\x91\xa9\xe2\x80\x8d");
+	copy_cell_expect(screen, 2, 1, "\xf0\x9f\x92\xbb");
+
+	/* controls end the cluster, marks without a base are dropped */
+	tsm_vte_input(vte, "\r\xcc\x81", 3);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 0);
+	copy_all_expect(screen, "e\xcc\x81x\n\xf0\x9f\x91\xa9"
+				"\xe2\x80\x8d\xf0\x9f\x92\xbb|\n");
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
 TEST_DEFINE_CASE(misc)
 	TEST(test_vte_init)
     TEST(test_vte_null)
     TEST(test_vte_custom_palette)
+    TEST(test_vte_grapheme)
 TEST_END_CASE
 
 // clang-format off